@@ -0,0 +1,109 @@
+#include "frame_scheduler.h"
+
+FrameScheduler::FrameScheduler(size_t render_threads, size_t max_in_flight)
+    : rendered(max_in_flight), encoded(max_in_flight)
+{
+    assert(render_threads > 0);
+    // every render worker needs a slot, otherwise some of them could never claim a frame.
+    assert(max_in_flight >= render_threads);
+
+    this->render_threads = render_threads;
+    this->max_in_flight = max_in_flight;
+    this->frame_count = 0;
+    this->next_frame = 0;
+    this->frames_written = 0;
+    this->stopping = false;
+
+    for (size_t t = 0; t < render_threads; t++)
+        workers.emplace_back(&FrameScheduler::render_frames, this);
+    encoder = std::thread(&FrameScheduler::encode_frames, this);
+}
+
+FrameScheduler::~FrameScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(claim_mutex);
+        stopping = true;
+        claim_ready.notify_all();
+    }
+    for (std::thread &worker : workers)
+        worker.join();
+    rendered.close();
+    encoder.join();
+}
+
+// hand out the next frame index of the current run, waiting while there is none left
+// or the writer is max_in_flight frames behind. returns false once the scheduler is being destroyed.
+bool FrameScheduler::claim_frame(int &index)
+{
+    std::unique_lock<std::mutex> lock(claim_mutex);
+    claim_ready.wait(lock, [&] {
+        return stopping || (next_frame < frame_count && next_frame - frames_written < (int)max_in_flight);
+    });
+    if (stopping)
+        return false;
+    index = next_frame++;
+    return true;
+}
+
+void FrameScheduler::release_frame()
+{
+    std::lock_guard<std::mutex> lock(claim_mutex);
+    frames_written++;
+    claim_ready.notify_all();
+}
+
+// stage 1: render, one framebuffer per frame.
+void FrameScheduler::render_frames()
+{
+    int index;
+    while (claim_frame(index))
+    {
+        Frame frame;
+        frame.index = index;
+        render(frame);
+        rendered.push(std::move(frame));
+    }
+}
+
+// stage 2: encode, in whatever order the frames finish rendering.
+void FrameScheduler::encode_frames()
+{
+    Frame frame;
+    while (rendered.pop(frame))
+    {
+        encode(frame);
+        encoded.push(std::move(frame));
+    }
+}
+
+void FrameScheduler::run(int frame_count, RenderStage render, EncodeStage encode, WriteStage write)
+{
+    {
+        // the previous run is fully written, so no worker is inside a stage while they are replaced.
+        std::lock_guard<std::mutex> lock(claim_mutex);
+        this->render = std::move(render);
+        this->encode = std::move(encode);
+        this->frame_count = frame_count;
+        next_frame = 0;
+        frames_written = 0;
+        claim_ready.notify_all();
+    }
+
+    // stage 3: write, reordered by index. pending holds the frames that arrived before their turn.
+    std::map<int, Frame> pending;
+    int next_to_write = 0;
+    Frame frame;
+    while (next_to_write < frame_count && encoded.pop(frame))
+    {
+        pending.emplace(frame.index, std::move(frame));
+        for (auto it = pending.find(next_to_write); it != pending.end(); it = pending.find(next_to_write))
+        {
+            write(it->second);
+            pending.erase(it);
+            next_to_write++;
+            release_frame();
+        }
+    }
+    assert(next_to_write == frame_count);
+}
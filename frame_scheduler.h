@@ -0,0 +1,133 @@
+#ifndef FRAME_SCHEDULER_H
+#define FRAME_SCHEDULER_H
+#include <global_variables.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// one frame moving through the pipeline.
+// pixels (rgba) or indexed (one palette index per pixel) is filled by the render stage, bytes by the encode stage.
+struct Frame
+{
+    int index;
+    std::vector<uint32_t> pixels;
+    std::vector<uint8_t> indexed;
+    std::string bytes;
+};
+
+// a fixed-size queue between two pipeline stages.
+// push() blocks when the queue is full, pop() blocks when it is empty.
+// Once close() is called, push() drops the item and returns false, pop() drains what is left and then returns false.
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [this] { return items.size() < capacity || closed; });
+        if (closed)
+            return false;
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+        return true;
+    }
+
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this] { return !items.empty() || closed; });
+        if (items.empty())
+            return false;
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    // same as pop(), but gives up at deadline.
+    template <typename Clock, typename Duration>
+    bool pop_until(T &item, const std::chrono::time_point<Clock, Duration> &deadline)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!not_empty.wait_until(lock, deadline, [this] { return !items.empty() || closed; }) || items.empty())
+            return false;
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+private:
+    size_t capacity;
+    bool closed;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+};
+
+// renders batches of independent frames on a pool of threads.
+// The frames go through three stages: render -> encode -> write.
+// Render runs on render_threads workers, each with its own framebuffer, encode runs on one thread,
+// and write runs on the thread that called run(), which hands the frames over strictly in index order.
+// The threads are started once by the constructor and wait for the next run() in between,
+// so a server can run one batch after the other without spawning and joining threads every time.
+// At most max_in_flight frames are alive at once, so memory stays bounded however slow the writer is.
+class FrameScheduler
+{
+public:
+    using RenderStage = std::function<void(Frame &)>;
+    using EncodeStage = std::function<void(Frame &)>;
+    using WriteStage = std::function<void(const Frame &)>;
+
+    FrameScheduler(size_t render_threads, size_t max_in_flight);
+    ~FrameScheduler();
+
+    // renders frames 0 .. frame_count - 1 and returns once the last one is written. One run at a time.
+    void run(int frame_count, RenderStage render, EncodeStage encode, WriteStage write);
+
+private:
+    size_t render_threads;
+    size_t max_in_flight;
+    std::vector<std::thread> workers;
+    std::thread encoder;
+
+    // the queues never hold more than max_in_flight frames, so a push can never wait on the writer forever.
+    BoundedQueue<Frame> rendered;
+    BoundedQueue<Frame> encoded;
+
+    // the stages of the current run, set by run() before it hands out the first frame.
+    RenderStage render;
+    EncodeStage encode;
+
+    // frame indices are handed out under this lock, and only while fewer than max_in_flight frames are pending.
+    std::mutex claim_mutex;
+    std::condition_variable claim_ready;
+    int frame_count;
+    int next_frame;
+    int frames_written;
+    bool stopping;
+
+    bool claim_frame(int &index);
+    void release_frame();
+    void render_frames();
+    void encode_frames();
+};
+
+#endif // FRAME_SCHEDULER_H
@@ -5,6 +5,7 @@
 #include <fstream>
 #include <vector>
 #include <cstdint>
+#include <algorithm>
 #include <cassert>
 #include <utility>
 #include <filesystem>
@@ -21,6 +22,31 @@ struct Pixel
     int y;
 };
 
+// 16.16 fixed-point numbers: the pixel in the high 16 bits, the position inside the pixel in the low 16 bits.
+typedef int32_t fixed_t;
+const int FIXED_SHIFT = 16;
+const fixed_t FIXED_ONE = 1 << FIXED_SHIFT;
+
+inline fixed_t to_fixed(float value)
+{
+    return (fixed_t)std::lround(value * FIXED_ONE);
+}
+
+struct FixedPoint
+{
+    fixed_t x;
+    fixed_t y;
+};
+
+// palette of an indexed (one byte per pixel) framebuffer.
+enum PaletteIndex : uint8_t
+{
+    PALETTE_GRADIENT = 0, // background, the color depends on the pixel coordinates.
+    PALETTE_WALL,
+    PALETTE_VISIBLE,
+    PALETTE_PLAYER
+};
+
 struct Map
 {
     int w;
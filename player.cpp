@@ -2,7 +2,7 @@
 #include <cassert>
 #include <math.h>
 
-Player::Player(int map_pos_x, int map_pos_y, float view_width, float gaze_angle)
+Player::Player(float map_pos_x, float map_pos_y, float view_width, float gaze_angle)
 {
     assert(view_width > 0);
     assert(view_width < 2 * M_PI);
@@ -50,22 +50,21 @@ float Player::normalize_angle(float angle)
     return angle;
 }
 
-std::pair<Pixel, Pixel> Player::find_view_ranges(Map map)
+std::pair<Pixel, Pixel> Player::find_view_ranges(Map map, int win_w, int win_h)
 {
+    Pixel position = get_pixel_position(map, win_w, win_h);
+    size_t px = position.x; // player x in pixel
+    size_t py = position.y; // player y in pixel
 
-    size_t px = player.get_pix_position(map).x; // player x in pixel
-    size_t py = player.get_pix_position(map).y; // player y in pixel
-
-    player.gaze_angle = player.gaze_angle + M_PI / 180 * 15 * k; // increment the player angle by 15 degree for this round.
     // first find the end points of players view, which are the rays' intersection with the border.
-    float lower_bound_of_view = player.gaze_angle - player.view_width / 2; // lower bound of player view;
-    float upper_bound_of_view = player.gaze_angle + player.view_width / 2; // upper bound of player view;
-    // pre-treatment: find the map_corners to iterate;
+    float lower_bound_of_view = this->gaze_angle - this->view_width / 2; // lower bound of player view;
+    float upper_bound_of_view = this->gaze_angle + this->view_width / 2; // upper bound of player view;
     // calculate the intersection.
     Point intersection1 = find_intersection(lower_bound_of_view, px, py, win_w, win_h);
     Point intersection2 = find_intersection(upper_bound_of_view, px, py, win_w, win_h);
-    Pixel endpoint1 = {0, 0};
-    Pixel endpoint2 = {0, 0};
+    // transfer intersection (pixel) to ints to reduce calculation.
+    Pixel endpoint1 = {(int)intersection1.x, (int)intersection1.y};
+    Pixel endpoint2 = {(int)intersection2.x, (int)intersection2.y};
 
     return std::make_pair(endpoint1, endpoint2);
 }
@@ -86,24 +85,18 @@ Point Player::find_intersection(float theta, size_t px, size_t py, int max_w, in
     {
         intersection.x = px;
         intersection.y = py;
-        std::cout << "The intersection for angle: " << theta << " is ("
-                  << intersection.x << "," << intersection.y << ")" << std::endl;
         return intersection;
     }
     if (dx == 0)
     {
         intersection.x = px;
         intersection.y = dy > 0 ? max_h : 0;
-        std::cout << "The intersection for angle: " << theta << " is ("
-                  << intersection.x << "," << intersection.y << ")" << std::endl;
         return intersection;
     }
     if (dy == 0)
     {
         intersection.y = py;
         intersection.x = dx > 0 ? max_w : 0;
-        std::cout << "The intersection for angle: " << theta << " is ("
-                  << intersection.x << "," << intersection.y << ")" << std::endl;
         return intersection;
     }
     bool steep = false;
@@ -201,12 +194,24 @@ Point Player::find_intersection(float theta, size_t px, size_t py, int max_w, in
     {
         std::swap(intersection.x, intersection.y);
     }
-    std::cout << "The intersection for angle: " << theta << " is ("
-              << intersection.x << "," << intersection.y << ")" << std::endl;
     return intersection;
 }
 
-Pixel Player::get_pixel_position(Map map)
+Pixel Player::get_pixel_position(Map map, int win_w, int win_h)
 {
-  
-};
\ No newline at end of file
+    // the pixel the player stands in.
+    FixedPoint position = get_fixed_position(map, win_w, win_h);
+    Pixel pixel;
+    pixel.x = position.x >> FIXED_SHIFT;
+    pixel.y = position.y >> FIXED_SHIFT;
+    return pixel;
+}
+
+FixedPoint Player::get_fixed_position(Map map, int win_w, int win_h)
+{
+    // map_position is in map cells, scale it by the size of each map block, keeping the sub-pixel part.
+    FixedPoint position;
+    position.x = to_fixed(this->map_position.x * (win_w / map.w));
+    position.y = to_fixed(this->map_position.y * (win_h / map.h));
+    return position;
+}
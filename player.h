@@ -9,17 +9,18 @@ public:
     float view_width;
     float gaze_angle;
 
-    Player(int map_pos_x, int map_pos_y, float view_width, float gaze_angle);
+    Player(float map_pos_x, float map_pos_y, float view_width, float gaze_angle);
     ~Player();
 
     bool is_in_view(Pixel obj_pos);
-    Pixel get_pixel_position(Map map);
-    std::pair<Pixel, Pixel> find_view_ranges(Map map);
+    Pixel get_pixel_position(Map map, int win_w, int win_h);
+    FixedPoint get_fixed_position(Map map, int win_w, int win_h);
+    std::pair<Pixel, Pixel> find_view_ranges(Map map, int win_w, int win_h);
 
 
 private:
     float normalize_angle(float angle);
-    Point Player::find_intersection(float theta, size_t px, size_t py, int max_w, int max_h);
+    Point find_intersection(float theta, size_t px, size_t py, int max_w, int max_h);
 };
 
 #endif // PLAYER_H
\ No newline at end of file
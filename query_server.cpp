@@ -0,0 +1,417 @@
+#include "query_server.h"
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <list>
+#include <thread>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace
+{
+    volatile std::sig_atomic_t stop_requested = 0;
+
+    void request_stop(int)
+    {
+        stop_requested = 1;
+    }
+
+    // read exactly n bytes, returns false on end of file or error.
+    bool read_fully(int fd, char *buffer, size_t n)
+    {
+        while (n > 0)
+        {
+            ssize_t got = read(fd, buffer, n);
+            if (got < 0 && errno == EINTR)
+                continue;
+            if (got <= 0)
+                return false;
+            buffer += got;
+            n -= got;
+        }
+        return true;
+    }
+
+    bool write_fully(int fd, const char *buffer, size_t n)
+    {
+        while (n > 0)
+        {
+            ssize_t put = write(fd, buffer, n);
+            if (put < 0 && errno == EINTR)
+                continue;
+            if (put <= 0)
+                return false;
+            buffer += put;
+            n -= put;
+        }
+        return true;
+    }
+
+    void put_u32(std::string &bytes, uint32_t value)
+    {
+        bytes.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+    // 16 exact buckets for 0..15, then 16 sub-buckets for each power of two from 2^4 to 2^63.
+    this->buckets.assign(16 + 60 * 16, 0);
+    this->total = 0;
+}
+
+size_t LatencyHistogram::bucket_of(uint64_t value)
+{
+    if (value < 16)
+        return value;
+    int exponent = 63 - __builtin_clzll(value); // position of the highest bit, >= 4.
+    size_t sub = (value >> (exponent - 4)) & 15; // the 4 bits right below the highest one.
+    return (exponent - 3) * 16 + sub;
+}
+
+uint64_t LatencyHistogram::upper_bound_of(size_t bucket)
+{
+    if (bucket < 16)
+        return bucket;
+    int exponent = bucket / 16 + 3;
+    uint64_t sub = bucket % 16;
+    uint64_t lower = (16 + sub) << (exponent - 4);
+    return lower + (uint64_t(1) << (exponent - 4)) - 1;
+}
+
+void LatencyHistogram::record(uint64_t micros)
+{
+    buckets[bucket_of(micros)]++;
+    total++;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const
+{
+    if (total == 0)
+        return 0;
+    // rank of the sample we are looking for, 1-based.
+    uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(p * total));
+    uint64_t seen = 0;
+    for (size_t b = 0; b < buckets.size(); b++)
+    {
+        seen += buckets[b];
+        if (seen >= rank)
+            return upper_bound_of(b);
+    }
+    return upper_bound_of(buckets.size() - 1);
+}
+
+uint64_t LatencyHistogram::count() const
+{
+    return total;
+}
+
+Connection::Connection(int in_fd, int out_fd, bool owns_fd, size_t max_outstanding)
+    : replies(max_outstanding)
+{
+    assert(max_outstanding > 0);
+
+    this->in_fd = in_fd;
+    this->out_fd = out_fd;
+    this->owns_fd = owns_fd;
+    this->max_outstanding = max_outstanding;
+    this->outstanding = 0;
+    this->hung_up = false;
+    this->finished = false;
+}
+
+Connection::~Connection()
+{
+    if (owns_fd)
+    {
+        close(in_fd);
+        if (out_fd != in_fd)
+            close(out_fd);
+    }
+}
+
+bool Connection::begin_query()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] { return outstanding < max_outstanding || hung_up; });
+    if (hung_up)
+        return false;
+    outstanding++;
+    return true;
+}
+
+void Connection::end_query()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    outstanding--;
+    changed.notify_all();
+}
+
+void Connection::wait_idle()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] { return outstanding == 0 || hung_up; });
+}
+
+void Connection::hang_up()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    hung_up = true;
+    changed.notify_all();
+    shutdown(in_fd, SHUT_RDWR);
+    if (out_fd != in_fd)
+        shutdown(out_fd, SHUT_RDWR);
+}
+
+QueryServer::QueryServer(size_t win_w, size_t win_h, size_t worker_threads, size_t max_batch, std::chrono::microseconds batch_window,
+                         ValidateFn validate, VisibilityFn visibility, VisibilityCache *cache)
+    : queries(4 * max_batch), scheduler(worker_threads, std::max(worker_threads, max_batch))
+{
+    assert(worker_threads > 0);
+    assert(max_batch > 0);
+
+    this->win_w = win_w;
+    this->win_h = win_h;
+    this->max_batch = max_batch;
+    this->batch_window = batch_window;
+    this->validate = validate;
+    this->visibility = visibility;
+    this->cache = cache;
+    this->batches = 0;
+}
+
+QueryServer::~QueryServer() {}
+
+// decode the fixed-size requests of one client and queue them, until the client hangs up.
+void QueryServer::read_queries(std::shared_ptr<Connection> connection)
+{
+    char buffer[QUERY_SIZE];
+    while (read_fully(connection->in_fd, buffer, QUERY_SIZE))
+    {
+        PendingQuery pending;
+        std::memcpy(&pending.query.id, buffer + 0, 4);
+        std::memcpy(&pending.query.x, buffer + 4, 4);
+        std::memcpy(&pending.query.y, buffer + 8, 4);
+        std::memcpy(&pending.query.gaze_angle, buffer + 12, 4);
+        std::memcpy(&pending.query.view_width, buffer + 16, 4);
+        pending.connection = connection;
+        pending.arrival = std::chrono::steady_clock::now();
+        if (!connection->begin_query())
+            break; // the server is shutting down.
+        if (!queries.push(std::move(pending)))
+        {
+            connection->end_query();
+            break;
+        }
+    }
+    // the queries already queued are still answered, then the writer is told nothing else is coming.
+    connection->wait_idle();
+    connection->replies.close();
+}
+
+// send the replies of one client as they come, until its reader closes the queue.
+void QueryServer::write_replies(std::shared_ptr<Connection> connection)
+{
+    Reply reply;
+    while (connection->replies.pop(reply))
+    {
+        write_fully(connection->out_fd, reply.bytes.data(), reply.bytes.size());
+        auto waited = std::chrono::steady_clock::now() - reply.arrival;
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            latency.record(std::chrono::duration_cast<std::chrono::microseconds>(waited).count());
+        }
+        connection->end_query();
+    }
+    connection->finished = true;
+}
+
+// wait for a query, then keep collecting until the batch is full or batch_window has passed.
+void QueryServer::process_batches()
+{
+    PendingQuery pending;
+    while (queries.pop(pending))
+    {
+        std::vector<PendingQuery> batch;
+        batch.push_back(std::move(pending));
+        auto deadline = std::chrono::steady_clock::now() + batch_window;
+        while (batch.size() < max_batch && queries.pop_until(pending, deadline))
+            batch.push_back(std::move(pending));
+
+        if (batches == 0)
+            first_arrival = batch.front().arrival;
+        process_batch(batch);
+
+        if (std::chrono::steady_clock::now() - last_report > std::chrono::seconds(5))
+            report_stats();
+    }
+}
+
+// the batch is one run of the server's frame scheduler: render the mask (or find it in the cache), pack it into bits, reply.
+void QueryServer::process_batch(std::vector<PendingQuery> &batch)
+{
+    batches++;
+    std::vector<char> accepted(batch.size(), false); // not vector<bool>, the render threads write neighbouring entries.
+    std::vector<VisibilityKey> keys(batch.size());
+    std::vector<std::shared_ptr<const std::string>> cached(batch.size());
+    scheduler.run(
+        batch.size(),
+        [&](Frame &frame)
+        {
+            ViewerQuery query = batch[frame.index].query;
+            if (!validate(query))
+                return; // rejected as received, it never reaches the cache.
+            accepted[frame.index] = true;
+            if (cache)
+            {
+                keys[frame.index] = cache->make_key(query.x, query.y, query.gaze_angle, query.view_width);
+                if (cache->lookup(keys[frame.index], cached[frame.index]))
+                    return;
+                cache->snapped_state(keys[frame.index], query.x, query.y, query.gaze_angle, query.view_width);
+            }
+            frame.indexed.assign(win_w * win_h, PALETTE_GRADIENT);
+            visibility(query, frame.indexed);
+        },
+        [&](Frame &frame)
+        {
+            const ViewerQuery &query = batch[frame.index].query;
+            bool ok = accepted[frame.index];
+            frame.bytes.clear();
+            put_u32(frame.bytes, query.id);
+            put_u32(frame.bytes, ok ? QUERY_OK : QUERY_REJECTED);
+            put_u32(frame.bytes, win_w);
+            put_u32(frame.bytes, win_h);
+            if (ok && cached[frame.index])
+            {
+                frame.bytes += *cached[frame.index];
+            }
+            else if (ok)
+            {
+                auto mask = std::make_shared<std::string>((win_w * win_h + 7) / 8, 0);
+                for (size_t i = 0; i < win_w * win_h; i++)
+                {
+                    if (frame.indexed[i] != PALETTE_GRADIENT)
+                        (*mask)[i / 8] |= 1 << (i % 8);
+                }
+                frame.bytes += *mask;
+                if (cache)
+                    cache->insert(keys[frame.index], std::move(mask));
+            }
+            std::vector<uint8_t>().swap(frame.indexed);
+        },
+        [&](const Frame &frame)
+        {
+            // never blocks: a connection has room for a reply to every query its reader let through.
+            const PendingQuery &pending = batch[frame.index];
+            pending.connection->replies.push(Reply{frame.bytes, pending.arrival});
+        });
+}
+
+void QueryServer::report_stats()
+{
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    last_report = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(last_report - first_arrival).count();
+    double qps = seconds > 0 ? latency.count() / seconds : 0;
+    std::cerr << "queries: " << latency.count() << ", batches: " << batches << ", qps: " << qps
+              << ", latency p50: " << latency.percentile(0.50) << " us"
+              << ", p99: " << latency.percentile(0.99) << " us"
+              << ", p999: " << latency.percentile(0.999) << " us" << std::endl;
+    if (cache)
+        std::cerr << "cache hits: " << cache->hits() << ", misses: " << cache->misses()
+                  << ", evictions: " << cache->evictions() << ", bytes: " << cache->bytes() << std::endl;
+}
+
+// answer the queries on stdin until it is closed, replies go to stdout.
+int QueryServer::serve_stdin()
+{
+    std::signal(SIGPIPE, SIG_IGN);
+    last_report = std::chrono::steady_clock::now();
+    auto connection = std::make_shared<Connection>(STDIN_FILENO, STDOUT_FILENO, false, 4 * max_batch);
+    std::thread reader([this, connection] {
+        read_queries(connection);
+        queries.close();
+    });
+    std::thread writer(&QueryServer::write_replies, this, connection);
+    process_batches();
+    reader.join();
+    writer.join();
+    report_stats();
+    return 0;
+}
+
+// answer the queries of every client connected to socket_path, until SIGINT or SIGTERM.
+int QueryServer::serve_socket(const std::string &socket_path)
+{
+    sockaddr_un address = {};
+    if (socket_path.size() >= sizeof(address.sun_path))
+    {
+        std::cerr << "socket path is too long: " << socket_path << std::endl;
+        return 1;
+    }
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path.c_str());
+    if (listen_fd < 0 || bind(listen_fd, (sockaddr *)&address, sizeof(address)) < 0 || listen(listen_fd, 64) < 0)
+    {
+        std::cerr << "cannot listen on " << socket_path << ": " << std::strerror(errno) << std::endl;
+        if (listen_fd >= 0)
+            close(listen_fd);
+        return 1;
+    }
+    std::cerr << "listening on " << socket_path << std::endl;
+
+    std::signal(SIGPIPE, SIG_IGN);
+    std::signal(SIGINT, request_stop);
+    std::signal(SIGTERM, request_stop);
+    last_report = std::chrono::steady_clock::now();
+    std::thread batcher([this] { process_batches(); });
+
+    // poll with a timeout so a stop request is noticed even when no client connects.
+    std::list<Client> clients;
+    while (!stop_requested)
+    {
+        // join the clients that are gone.
+        for (auto it = clients.begin(); it != clients.end();)
+        {
+            if (!it->connection->finished)
+            {
+                ++it;
+                continue;
+            }
+            it->reader.join();
+            it->writer.join();
+            it = clients.erase(it);
+        }
+
+        pollfd listening = {listen_fd, POLLIN, 0};
+        if (poll(&listening, 1, 200) <= 0)
+            continue;
+        int client_fd = accept(listen_fd, nullptr, nullptr);
+        if (client_fd < 0)
+            continue;
+        auto connection = std::make_shared<Connection>(client_fd, client_fd, true, 4 * max_batch);
+        clients.push_back({connection, std::thread(&QueryServer::read_queries, this, connection),
+                           std::thread(&QueryServer::write_replies, this, connection)});
+    }
+
+    // a client that never hangs up must not keep the server alive: shut every socket down,
+    // so no reader is left to queue a query once the batcher is gone.
+    for (Client &client : clients)
+        client.connection->hang_up();
+    for (Client &client : clients)
+    {
+        client.reader.join();
+        client.writer.join();
+    }
+    queries.close();
+    batcher.join();
+    close(listen_fd);
+    unlink(socket_path.c_str());
+    report_stats();
+    return 0;
+}
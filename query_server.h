@@ -0,0 +1,144 @@
+#ifndef QUERY_SERVER_H
+#define QUERY_SERVER_H
+#include <global_variables.h>
+#include <frame_scheduler.h>
+#include <visibility_cache.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+// wire format, all fields in host byte order.
+// request, 20 bytes:  uint32 id | float x | float y | float gaze_angle | float view_width
+//                     x and y are in map cells, the angles in radians.
+// reply, 16 bytes header: uint32 id | uint32 status | uint32 w | uint32 h
+//                     followed by (w * h + 7) / 8 bytes of visibility mask when status is QUERY_OK.
+//                     pixel (x, y) is bit (x + y * w) % 8 of byte (x + y * w) / 8.
+const size_t QUERY_SIZE = 20;
+const size_t REPLY_HEADER_SIZE = 16;
+const uint32_t QUERY_OK = 0;
+const uint32_t QUERY_REJECTED = 1; // the viewer state is out of range, no mask follows.
+
+struct ViewerQuery
+{
+    uint32_t id;
+    float x;
+    float y;
+    float gaze_angle;
+    float view_width;
+};
+
+// latency histogram with log-linear buckets: every power of two is split into 16 sub-buckets,
+// so a reported percentile is at most 1/16 above the real value, whatever the range.
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void record(uint64_t micros);
+    uint64_t percentile(double p) const; // p in [0, 1], in micro seconds.
+    uint64_t count() const;
+
+private:
+    std::vector<uint64_t> buckets;
+    uint64_t total;
+
+    static size_t bucket_of(uint64_t value);
+    static uint64_t upper_bound_of(size_t bucket);
+};
+
+// a reply ready to be sent, and when its query arrived.
+struct Reply
+{
+    std::string bytes;
+    std::chrono::steady_clock::time_point arrival;
+};
+
+// one client. Its reader thread queues the queries, its writer thread sends the replies in the order the batches finish.
+// At most max_outstanding queries of a client wait for their reply: past that its reader stops reading,
+// so a client that does not read its replies only holds up itself, and handing a reply over never blocks the batcher.
+struct Connection
+{
+    int in_fd;
+    int out_fd;
+    bool owns_fd; // the socket is closed with the connection, stdin / stdout are not.
+    BoundedQueue<Reply> replies;
+
+    Connection(int in_fd, int out_fd, bool owns_fd, size_t max_outstanding);
+    ~Connection();
+
+    bool begin_query(); // waits while max_outstanding replies are pending, false once hung up.
+    void end_query();   // a reply was sent.
+    void wait_idle();   // waits until every pending reply was sent, or the connection is hung up.
+    // the server is stopping: shut the socket down so the reader and the writer return from read() and write().
+    void hang_up();
+
+    std::atomic<bool> finished; // set by the writer when it is done, both threads can then be joined.
+
+private:
+    size_t max_outstanding;
+    size_t outstanding;
+    bool hung_up;
+    std::mutex mutex;
+    std::condition_variable changed;
+};
+
+// long-running visibility service: the map is loaded once by the caller, the server answers viewer queries
+// read from stdin or from a unix domain socket. Queries that arrive within batch_window of each other are
+// grouped (up to max_batch) and rendered together on a FrameScheduler that lives as long as the server.
+// With a cache, a viewer state that was answered before is a lookup instead of a render.
+class QueryServer
+{
+public:
+    // returns false if the viewer state is rejected. It sees the query as it was received, before the cache snaps it.
+    using ValidateFn = std::function<bool(const ViewerQuery &)>;
+    // draws the visible pixels of an accepted viewer into an indexed framebuffer cleared to PALETTE_GRADIENT,
+    // any other index counts as visible.
+    using VisibilityFn = std::function<void(const ViewerQuery &, std::vector<uint8_t> &)>;
+
+    QueryServer(size_t win_w, size_t win_h, size_t worker_threads, size_t max_batch, std::chrono::microseconds batch_window,
+                ValidateFn validate, VisibilityFn visibility, VisibilityCache *cache = nullptr);
+    ~QueryServer();
+
+    int serve_stdin();
+    int serve_socket(const std::string &socket_path);
+
+private:
+    struct PendingQuery
+    {
+        ViewerQuery query;
+        std::shared_ptr<Connection> connection;
+        std::chrono::steady_clock::time_point arrival;
+    };
+
+    // the threads serving one socket client.
+    struct Client
+    {
+        std::shared_ptr<Connection> connection;
+        std::thread reader;
+        std::thread writer;
+    };
+
+    size_t win_w;
+    size_t win_h;
+    size_t max_batch;
+    std::chrono::microseconds batch_window;
+    ValidateFn validate;
+    VisibilityFn visibility;
+    VisibilityCache *cache;
+
+    BoundedQueue<PendingQuery> queries;
+    FrameScheduler scheduler; // one pool for the lifetime of the server, every batch is a run on it.
+    std::mutex stats_mutex; // the writers record the latency, the batcher reports it.
+    LatencyHistogram latency;
+    uint64_t batches;
+    std::chrono::steady_clock::time_point first_arrival;
+    std::chrono::steady_clock::time_point last_report;
+
+    void read_queries(std::shared_ptr<Connection> connection);
+    void write_replies(std::shared_ptr<Connection> connection);
+    void process_batches();
+    void process_batch(std::vector<PendingQuery> &batch);
+    void report_stats();
+};
+
+#endif // QUERY_SERVER_H
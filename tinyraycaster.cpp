@@ -1,7 +1,11 @@
 
 
 #include <player.h>
+#include <frame_scheduler.h>
+#include <query_server.h>
+#include <visibility_polygon.h>
 #include <global_variables.h>
+#include <thread>
 
 uint32_t pack_color(const uint8_t r, const uint8_t g, const uint8_t b, const uint8_t a = 255)
 {
@@ -16,19 +20,45 @@ void unpack_color(const uint32_t &color, uint8_t &r, uint8_t &g, uint8_t &b, uin
     a = (color >> 24) & 255;
 }
 
-// save the framebuffer into a file.
-void drop_ppm_image(const std::string filename, const std::vector<uint32_t> &image, const size_t w, const size_t h)
+// the background gradient at pixel (i, j).
+uint32_t gradient_color(const size_t i, const size_t j, const size_t w, const size_t h)
+{
+    uint8_t r = 255 * j / float(h); // varies between 0 and 255 as j sweeps the vertical
+    uint8_t g = 255 * i / float(w); // varies between 0 and 255 as i sweeps the horizontal
+    uint8_t b = 0;
+    return pack_color(r, g, b);
+}
+
+// color of a palette index at pixel (i, j) of an indexed framebuffer.
+// the gradient is not stored in the palette, it is computed from the coordinates when the image is written.
+uint32_t palette_color(const uint8_t index, const size_t i, const size_t j, const size_t w, const size_t h)
+{
+    switch (index)
+    {
+    case PALETTE_WALL:
+        return pack_color(0, 255, 255);
+    case PALETTE_VISIBLE:
+        return pack_color(255, 255, 255);
+    case PALETTE_PLAYER:
+        return pack_color(255, 0, 0);
+    default:
+        return gradient_color(i, j, w, h);
+    }
+}
+
+// encode the framebuffer as a binary ppm image.
+std::string encode_ppm_image(const std::vector<uint32_t> &image, const size_t w, const size_t h)
 {
     assert(image.size() == w * h);
-    // ofstream write files.
-    std::ofstream ofs(filename);
     // for ppm format, the header goes:
     // First line: P3(plain text data)/P6 (binary data)
     // Second line: width " " height
     // Third line: Maximum color value. In this case 255,
     // when we use 8 bit to store color per channel.
-    ofs << "P6\n"
-        << w << " " << h << "\n255\n";
+    std::string header = "P6\n" + std::to_string(w) + " " + std::to_string(h) + "\n255\n";
+    std::string bytes;
+    bytes.reserve(header.size() + 3 * w * h);
+    bytes += header;
     // After the header, each pixel is stored.
     // although each color use 4 byte = 32 bits to store r,g,b,a,
     // only r,g,b are written in the file.
@@ -39,13 +69,53 @@ void drop_ppm_image(const std::string filename, const std::vector<uint32_t> &ima
     {
         uint8_t r, g, b, a;
         unpack_color(image[i], r, g, b, a);
-        ofs << static_cast<char>(r) << static_cast<char>(g) << static_cast<char>(b);
+        bytes += static_cast<char>(r);
+        bytes += static_cast<char>(g);
+        bytes += static_cast<char>(b);
+    }
+    return bytes;
+}
+
+// encode an indexed framebuffer as a binary ppm image, resolving the palette pixel by pixel.
+std::string encode_ppm_image(const std::vector<uint8_t> &image, const size_t w, const size_t h)
+{
+    assert(image.size() == w * h);
+    std::string header = "P6\n" + std::to_string(w) + " " + std::to_string(h) + "\n255\n";
+    std::string bytes;
+    bytes.reserve(header.size() + 3 * w * h);
+    bytes += header;
+    for (size_t j = 0; j < h; ++j)
+    {
+        for (size_t i = 0; i < w; ++i)
+        {
+            uint8_t r, g, b, a;
+            unpack_color(palette_color(image[i + j * w], i, j, w, h), r, g, b, a);
+            bytes += static_cast<char>(r);
+            bytes += static_cast<char>(g);
+            bytes += static_cast<char>(b);
+        }
     }
+    return bytes;
+}
+
+// save an encoded image into a file.
+void drop_image_bytes(const std::string filename, const std::string &bytes)
+{
+    // ofstream write files.
+    std::ofstream ofs(filename, std::ios::binary);
+    ofs.write(bytes.data(), bytes.size());
     ofs.close();
 }
 
-void draw_rectangle(std::vector<uint32_t> &img, const size_t img_w, const size_t img_h,
-                    const size_t x, const size_t y, const size_t w, const size_t h, const uint32_t color)
+// save the framebuffer into a file.
+void drop_ppm_image(const std::string filename, const std::vector<uint32_t> &image, const size_t w, const size_t h)
+{
+    drop_image_bytes(filename, encode_ppm_image(image, w, h));
+}
+
+template <typename Color>
+void draw_rectangle(std::vector<Color> &img, const size_t img_w, const size_t img_h,
+                    const size_t x, const size_t y, const size_t w, const size_t h, const Color color)
 {
     assert(img.size() == img_w * img_h);
     for (size_t i = 0; i < w; i++)
@@ -73,349 +143,529 @@ void generate_hit_map(std::vector<char> *hit_map, size_t hit_w, size_t hit_h, si
         }
     }
 }
+// step_ray() walks from the sub-pixel origin to the centre of pixel (end_x, end_y), one pixel along the primary axis per step,
+// and calls visit(x, y) on every pixel until it returns false. returns true if the end point was reached.
+// Only the set-up reads the origin, the loop itself is integer arithmetic on 16.16 fixed-point numbers,
+// so the same origin always gives the same pixels, whichever thread renders it.
+template <typename Visit>
+bool step_ray(FixedPoint origin, int end_x, int end_y, const size_t win_w, const size_t win_h, Visit visit)
+{
+    int64_t dx = ((int64_t)end_x << FIXED_SHIFT) + FIXED_ONE / 2 - origin.x;
+    int64_t dy = ((int64_t)end_y << FIXED_SHIFT) + FIXED_ONE / 2 - origin.y;
+
+    // projects everything onto the transposed space when the line is steep.
+    bool steep = std::llabs(dy) > std::llabs(dx);
+    int64_t c_pri = steep ? origin.y : origin.x; // origin on the primary axis
+    int64_t c_sec = steep ? origin.x : origin.y; // origin on the secondary axis
+    int64_t d_pri = steep ? dy : dx;
+    int64_t d_sec = steep ? dx : dy;
+    int end_pri = steep ? end_y : end_x;
+
+    // the pixel that contains the origin comes first.
+    int last_x = origin.x >> FIXED_SHIFT;
+    int last_y = origin.y >> FIXED_SHIFT;
+    if (last_x < 0 || last_y < 0 || last_x >= (int)win_w || last_y >= (int)win_h)
+        return false;
+    if (!visit(last_x, last_y))
+        return false;
+    if (d_pri == 0) // the end point is the origin.
+        return true;
+
+    int pri = c_pri >> FIXED_SHIFT; // pixel of the origin on the primary axis
+    int step = d_pri < 0 ? -1 : 1;
+
+    // secondary coordinate at the centre of the first pixel, then its change for each pixel along the primary axis.
+    // That centre can be up to half a pixel behind the origin, where the ray never passes: on a pixel boundary
+    // it would land in the neighbouring pixel, so the first sample is only taken when it is ahead of the origin.
+    int64_t centre = ((int64_t)pri << FIXED_SHIFT) + FIXED_ONE / 2;
+    int64_t sec = c_sec + d_sec * (centre - c_pri) / d_pri;
+    int64_t slope = d_sec * FIXED_ONE / std::llabs(d_pri);
+    bool behind = (centre - c_pri) * step < 0;
+
+    for (int n = std::abs(end_pri - pri); n >= 0; n--, pri += step, sec += slope)
+    {
+        if (behind)
+        {
+            behind = false;
+            continue;
+        }
+        int x = steep ? sec >> FIXED_SHIFT : pri;
+        int y = steep ? pri : sec >> FIXED_SHIFT;
+        if (x == last_x && y == last_y)
+            continue; // already visited as the origin's pixel.
+        if (x < 0 || y < 0 || x >= (int)win_w || y >= (int)win_h)
+            return false;
+        if (!visit(x, y))
+            return false;
+        last_x = x;
+        last_y = y;
+    }
+    return true;
+}
+
 // cast_ray() draws a line to connect the begin and end points.
 // refactor to take cartesian coordinates as input. Leave the coordinate conversion to the main function.
-void cast_ray(int px, int py, int end_x, int end_y, const size_t win_w, const size_t win_h, std::vector<char> &hit_map, std::vector<unsigned int> &framebuffer)
+// Color is uint32_t for a rgba framebuffer, or uint8_t for an indexed one.
+template <typename Color>
+void cast_ray(FixedPoint origin, int end_x, int end_y, const size_t win_w, const size_t win_h, const std::vector<char> &hit_map,
+              std::vector<Color> &framebuffer, const Color visible)
 {
-    float dx = end_x - px;
-    float dy = end_y - py;
+    step_ray(origin, end_x, end_y, win_w, win_h, [&](int x, int y)
+             {
+                 size_t index = x + y * win_w;
+                 if (hit_map[index] != ' ')
+                     return false;
+                 framebuffer[index] = visible;
+                 return true; });
+}
+
+// Utility function to normalize an angle to the range [0, 2*PI)
+float normalize_angle(float angle)
+{
+    while (angle < 0)
+        angle += 2 * M_PI;
+    while (angle >= 2 * M_PI)
+        angle -= 2 * M_PI;
+    return angle;
+}
 
-    int stepx = (dx == 0) ? 0 : (dx < 0 ? -1 : 1);
-    int stepy = (dy == 0) ? 0 : (dy < 0 ? -1 : 1);
+bool is_in_view_range(float corner_x, float corner_y, float player_x, float player_y, float lower_bound_of_view, float upper_bound_of_view)
+{
+    // Calculate the angle of the vertex with respect to the player's position
+    float vertex_angle = atan2(corner_y - player_y, corner_x - player_x);
 
-    bool steep = false;  // flag that idicates the data needs to be transposed.
-    int lim_pri = win_w; // limit of the primary axis
-    int c_x = px;        // cast's coordinate at primary axis;
-    int c_y = py;        // cast's coordinate at secondary axis;
+    // Normalize the angles to be within [0, 2*PI)
+    lower_bound_of_view = normalize_angle(lower_bound_of_view);
+    upper_bound_of_view = normalize_angle(upper_bound_of_view);
+    vertex_angle = normalize_angle(vertex_angle);
 
-    int abs_dy = abs(dy);
-    int abs_dx = abs(dx);
-    if (abs_dy > abs_dx) // projects everything onto the transposed space.
+    // Check if the vertex_angle lies between theta1 and theta2
+    if (lower_bound_of_view <= upper_bound_of_view)
     {
-        steep = true;
-        lim_pri = win_h;
-        std::swap(c_x, c_y);
-        std::swap(abs_dx, abs_dy);
-        std::swap(stepx, stepy);
+        return vertex_angle >= lower_bound_of_view && vertex_angle <= upper_bound_of_view;
     }
-
-    assert(abs_dx != 0);
-    int sum_y = 0;
-    while (c_x >= 0 && c_x <= lim_pri)
+    else
     {
-        // render first;
-        if (steep) // transpose back by switching x, y coordinates in the coordinate reference.
-        {
-            if (hit_map[c_y + c_x * win_w] != ' ')
-                break;
-            framebuffer[c_y + c_x * win_w] = pack_color(255, 255, 255); // segfalut
-        }
-        else
-        {
-            if (hit_map[c_x + c_y * win_w] != ' ')
-                break;
-            framebuffer[c_x + c_y * win_w] = pack_color(255, 255, 255); // segfalut
-        }
+        // Handle the case where the range crosses the 0-degree (or 2 * PI) line
+        return vertex_angle >= lower_bound_of_view || vertex_angle <= upper_bound_of_view;
+    }
+}
 
-        // then figure out the next pixel.
-        c_x += stepx;
-        sum_y += abs_dy;
-        /*
-            sum_delta - 1 converts in relation to dx, dy:
-            sum_delta - sum_y/ sum_x;
-            -> let sum_delta = k;
-            sum_y / sum_x  = k
-            sum_y = sum_x * k;
-            changes to:
-            sum_y / sum_x  = k -1;
-            sum_y = sum_x * k - sum_x;
-            sum_y needs to substract sum_x.
-        */
-        if (2 * sum_y > abs_dx)
+// trace_ray() walks the same line as cast_ray(), but only reports whether the end point can be reached.
+// It does not write to the framebuffer, so it can be used to query a single pixel.
+bool trace_ray(FixedPoint origin, int end_x, int end_y, const size_t win_w, const size_t win_h, const std::vector<char> &hit_map)
+{
+    return step_ray(origin, end_x, end_y, win_w, win_h, [&](int x, int y)
+                    { return hit_map[x + y * win_w] == ' '; });
+}
+
+// self-check for step_ray(): a ray that starts exactly on the top or left edge of an empty cell, on a pixel boundary,
+// reaches every pixel on the border of that cell. The cell behind the edge may be a wall, so a ray that started
+// in the pixel behind its origin would stop at once.
+bool boundary_rays_reach_end(const Map &map, const size_t win_w, const size_t win_h, const std::vector<char> &hit_map)
+{
+    const int rect_w = win_w / map.w; // the width of each map block
+    const int rect_h = win_h / map.h; // the height of each map block
+    for (int j = 0; j < map.h; j++)
+    {
+        for (int i = 0; i < map.w; i++)
         {
-            c_y += stepy;
-            sum_y -= abs_dx;
+            if (map.map[i + j * map.w] != ' ')
+                continue;
+            int x0 = i * rect_w;
+            int y0 = j * rect_h;
+            // the top left corner, the middle of the top edge and the middle of the left edge.
+            FixedPoint origins[3] = {{x0 << FIXED_SHIFT, y0 << FIXED_SHIFT},
+                                     {(x0 + rect_w / 2) << FIXED_SHIFT, y0 << FIXED_SHIFT},
+                                     {x0 << FIXED_SHIFT, (y0 + rect_h / 2) << FIXED_SHIFT}};
+            for (const FixedPoint &origin : origins)
+            {
+                for (int k = 0; k < rect_w; k++)
+                {
+                    if (!trace_ray(origin, x0 + k, y0, win_w, win_h, hit_map) ||
+                        !trace_ray(origin, x0 + k, y0 + rect_h - 1, win_w, win_h, hit_map))
+                        return false;
+                }
+                for (int k = 0; k < rect_h; k++)
+                {
+                    if (!trace_ray(origin, x0, y0 + k, win_w, win_h, hit_map) ||
+                        !trace_ray(origin, x0 + rect_w - 1, y0 + k, win_w, win_h, hit_map))
+                        return false;
+                }
+            }
         }
     }
+    return true;
 }
 
-Point find_intersection(float theta, size_t px, size_t py, int max_w, int max_h)
+// check if the ray starting at (px, py) in direction theta passes through the box [x0, x1] x [y0, y1].
+// slab test: clip the ray against the vertical and the horizontal edges of the box.
+bool ray_hits_box(float px, float py, float theta, float x0, float y0, float x1, float y1)
 {
-    // initialize parameters
-    Point intersection;
     const float epsilon = 1e-6;
-    // if steep, transpose to avoid tan(theta) being too big.
     float dx = cos(theta);
-    if (abs(dx) < epsilon)
-        dx = 0.0f;
     float dy = sin(theta);
-    if (abs(dy) < epsilon)
-        dy = 0.0f;
-    if (dx == 0 && dy == 0)
+    float t_min = 0;
+    float t_max = INFINITY;
+
+    if (fabs(dx) < epsilon)
     {
-        intersection.x = px;
-        intersection.y = py;
-        std::cout << "The intersection for angle: " << theta << " is ("
-                  << intersection.x << "," << intersection.y << ")" << std::endl;
-        return intersection;
+        if (px < x0 || px > x1)
+            return false;
     }
-    if (dx == 0)
+    else
     {
-        intersection.x = px;
-        intersection.y = dy > 0 ? max_h : 0;
-        std::cout << "The intersection for angle: " << theta << " is ("
-                  << intersection.x << "," << intersection.y << ")" << std::endl;
-        return intersection;
+        float t1 = (x0 - px) / dx;
+        float t2 = (x1 - px) / dx;
+        t_min = std::max(t_min, std::min(t1, t2));
+        t_max = std::min(t_max, std::max(t1, t2));
     }
-    if (dy == 0)
+
+    if (fabs(dy) < epsilon)
     {
-        intersection.y = py;
-        intersection.x = dx > 0 ? max_w : 0;
-        std::cout << "The intersection for angle: " << theta << " is ("
-                  << intersection.x << "," << intersection.y << ")" << std::endl;
-        return intersection;
+        if (py < y0 || py > y1)
+            return false;
     }
-    bool steep = false;
-    if (dy > dx)
+    else
     {
-        std::swap(px, py);
-        std::swap(max_h, max_w);
-        std::swap(dx, dy);
-        steep = true;
+        float t1 = (y0 - py) / dy;
+        float t2 = (y1 - py) / dy;
+        t_min = std::max(t_min, std::min(t1, t2));
+        t_max = std::min(t_max, std::max(t1, t2));
     }
-    float slope = dy / dx;
-    int intercept = py - slope * px;
-
-    // find intersection with the limits. (make it a separate function)
-    // find the quadrant the intersection is in.
-    // if angle more than angle to the corner, change the known factor for intersection.
-    // plot the tangent function, you will find that in any quadrant, tan(theta) increases with theta.
+    return t_min <= t_max;
+}
 
-    if (dx > 0 && dy > 0)
+enum CellVisibility
+{
+    CELL_HIDDEN,  // no pixel of the cell can be seen, skip it.
+    CELL_PARTIAL, // the cell lies on a shadow edge or on the view border, refine pixel by pixel.
+    CELL_VISIBLE  // the whole cell can be seen, fill it as a block.
+};
+
+// walk_cells() is step_ray() at the resolution of the map: it walks the segment from (px, py) to (end_x, end_y), in pixels,
+// one map cell at a time, and calls visit(i, j, t) on every cell it enters until visit returns false, with t the position
+// along the segment where it enters, 0 at (px, py) and 1 at the end point. returns true if the end point was reached.
+// A segment that ends on a cell edge does not enter the cell behind it, and one that crosses a grid vertex enters
+// the cell beside it first, so it is stopped by two walls that touch at a corner. One that starts on a grid vertex
+// only touches that corner, it enters the diagonal cell directly.
+template <typename Visit>
+bool walk_cells(const Map &map, const int rect_w, const int rect_h, float px, float py, float end_x, float end_y, Visit visit)
+{
+    const float epsilon = 1e-4; // fraction of the segment that is still taken as its end point.
+    float dx = end_x - px;
+    float dy = end_y - py;
+    int i = (int)(px / rect_w);
+    int j = (int)(py / rect_h);
+    // position along the segment of the next vertical and horizontal cell edge.
+    float next_x = dx != 0 ? ((i + (dx > 0)) * rect_w - px) / dx : INFINITY;
+    float next_y = dy != 0 ? ((j + (dy > 0)) * rect_h - py) / dy : INFINITY;
+    while (std::min(next_x, next_y) < 1 - epsilon)
     {
-        int x_2_a = max_w - px; // horizontal distance to a, a is the corner in the first quadrant;
-        int y_2_a = max_h - py; // vertical distance to a, a a is the corner in the first quadrant;
-        // fisrt quadrant; compare with a
-        if (slope > ((float)y_2_a / x_2_a))
+        float t = std::min(next_x, next_y);
+        if (next_x == 0 && next_y == 0)
+        {
+            i += dx < 0 ? -1 : 1;
+            j += dy < 0 ? -1 : 1;
+            next_x += rect_w / std::fabs(dx);
+            next_y += rect_h / std::fabs(dy);
+        }
+        else if (next_x <= next_y)
         {
-            // tan(theta) > tan(a), know y, find x
-            intersection.y = max_h;
-            intersection.x = (intersection.y - intercept) / slope;
+            i += dx < 0 ? -1 : 1;
+            next_x += rect_w / std::fabs(dx);
         }
         else
         {
-            // tan(theta) < tan(a), know x, find y
-            intersection.x = max_w;
-            intersection.y = intersection.x * slope + intercept;
+            j += dy < 0 ? -1 : 1;
+            next_y += rect_h / std::fabs(dy);
         }
+        if (i < 0 || j < 0 || i >= map.w || j >= map.h)
+            return false;
+        if (!visit(i, j, t))
+            return false;
     }
+    return true;
+}
+
+// classify the map cell [x0, x1] x [y0, y1], in pixels, from which of its four corners the player sees.
+// All four corners seen means the whole cell is seen: the segments to the corners fan out over the cell, and a wall cell,
+// as large as this one, cannot fit between two of them without crossing one. All four hidden is a heuristic:
+// a beam through a gap between walls can be narrower than the cell and light its middle only, the cell is then
+// taken as hidden. The view borders can slip between the corners too, which is why they are tested against the box.
+CellVisibility classify_cell(float px, float py, float x0, float y0, float x1, float y1, const bool seen[4],
+                             float lower_bound_of_view, float upper_bound_of_view)
+{
+    if (px >= x0 && px < x1 && py >= y0 && py < y1)
+        return CELL_PARTIAL; // the player stands in this cell.
 
-    if (dx <= 0 && dy >= 0)
+    Point corners[4] = {{x0, y0}, {x1, y0}, {x1, y1}, {x0, y1}};
+    int in_view = 0;
+    int visible = 0;
+    for (int c = 0; c < 4; c++)
     {
-        // second quadrant; compare with b
-        int x_2_b = 0 - px;     // horizontal distance to b, b is the corner in the second quadrant;
-        int y_2_b = max_h - py; // vertical distance to b, b is the corner in the second quadrant;
-        if (slope < ((float)y_2_b / x_2_b))
-        {
-            // tan(theta) < tan(a), know y, find x
-            intersection.y = max_h;
-            intersection.x = (intersection.y - intercept) / slope;
-        }
-        else
-        {
-            // tan(theta) > tan(a), know x, find y
-            intersection.x = 0;
-            intersection.y = intersection.x * slope + intercept;
-        }
+        if (!is_in_view_range(corners[c].x, corners[c].y, px, py, lower_bound_of_view, upper_bound_of_view))
+            continue;
+        in_view++;
+        if (seen[c])
+            visible++;
     }
+    if (visible > 0 && visible < in_view)
+        return CELL_PARTIAL;
+
+    bool on_view_border = ray_hits_box(px, py, lower_bound_of_view, x0, y0, x1, y1) ||
+                          ray_hits_box(px, py, upper_bound_of_view, x0, y0, x1, y1);
+    if (visible == 4 && !on_view_border)
+        return CELL_VISIBLE;
+    if (visible == 0 && (in_view == 4 || !on_view_border))
+        return CELL_HIDDEN;
+    return CELL_PARTIAL;
+}
 
-    if (dx <= 0 && dy <= 0)
+// coarse-to-fine rendering of the player's view.
+// first pass works at the resolution of the map: a cell is classified by walking the map towards its corners,
+// cells that are fully visible are filled as a block, cells that are fully hidden are skipped.
+// The partial cells, along the shadow edges and the view borders, are refined with the edge sweep clipped to them:
+// rays to the pixels on the sides the view leaves the cell through, cast from where they enter it, once a walk on the map
+// has shown that nothing stops them before.
+template <typename Color>
+void render_view_coarse(const Map &map, FixedPoint origin, float lower_bound_of_view, float upper_bound_of_view,
+                        const size_t win_w, const size_t win_h, const std::vector<char> &hit_map,
+                        std::vector<Color> &framebuffer, const Color visible)
+{
+    const int rect_w = win_w / map.w; // the width of each map block
+    const int rect_h = win_h / map.h; // the height of each map block
+    const float px = (float)origin.x / FIXED_ONE;
+    const float py = (float)origin.y / FIXED_ONE;
+    assert(framebuffer.size() == win_w * win_h);
+
+    auto is_empty = [&](int i, int j, float)
     {
-        // third quadrant; compare with c
-        int x_2_c = 0 - px; // horizontal distance to d, d is the corner in the first quadrant;
-        int y_2_c = 0 - py; // vertical distance to d, d is the corner in the first quadrant;
-        if (slope > ((float)y_2_c / x_2_c))
-        {
-            // tan(theta) > tan(a), know y, find x
-            intersection.y = 0;
-            intersection.x = (intersection.y - intercept) / slope;
-        }
-        else
-        {
-            // tan(theta) < tan(a), know x, find y
-            intersection.x = 0;
-            intersection.y = intersection.x * slope + intercept;
-        }
+        return map.map[i + j * map.w] == ' ';
+    };
+    // which vertices of the map grid the player sees, each one shared by up to four cells.
+    std::vector<bool> vertex_seen((map.w + 1) * (map.h + 1));
+    for (int j = 0; j <= map.h; j++)
+    {
+        for (int i = 0; i <= map.w; i++)
+            vertex_seen[i + j * (map.w + 1)] = walk_cells(map, rect_w, rect_h, px, py, i * rect_w, j * rect_h, is_empty);
     }
-    if (dx >= 0 && dy <= 0)
+
+    std::vector<CellVisibility> cells(map.w * map.h, CELL_HIDDEN); // walls are never lit.
+    for (int j = 0; j < map.h; j++)
     {
-        // forth quadrant; compare with d
-        int x_2_d = max_w - px; // horizontal distance to d, d is the corner in the forth quadrant;
-        int y_2_d = 0 - py;     // vertical distance to d, d is the corner in the forth quadrant;
-        if (slope < ((float)y_2_d / x_2_d))
+        for (int i = 0; i < map.w; i++)
         {
-            // tan(theta) < tan(a), know y, find x
-            intersection.y = 0;
-            intersection.x = (intersection.y - intercept) / slope;
-        }
-        else
-        {
-            // tan(theta) < tan(a), know x, find y
-            intersection.x = max_w;
-            intersection.y = intersection.x * slope + intercept;
+            if (map.map[i + j * map.w] != ' ')
+                continue;
+            int x0 = i * rect_w;
+            int y0 = j * rect_h;
+            int x1 = x0 + rect_w - 1;
+            int y1 = y0 + rect_h - 1;
+
+            const int stride = map.w + 1;
+            bool seen[4] = {vertex_seen[i + j * stride], vertex_seen[i + 1 + j * stride],
+                            vertex_seen[i + 1 + (j + 1) * stride], vertex_seen[i + (j + 1) * stride]};
+            cells[i + j * map.w] = classify_cell(px, py, x0, y0, x1 + 1, y1 + 1, seen, lower_bound_of_view, upper_bound_of_view);
+            if (cells[i + j * map.w] != CELL_VISIBLE)
+                continue;
+            for (int y = y0; y <= y1; y++) // block write, one row at a time.
+                std::fill(framebuffer.begin() + x0 + y * win_w, framebuffer.begin() + x1 + 1 + y * win_w, visible);
         }
     }
 
-    if (steep)
+    // walk the map towards the pixel (end_x, end_y), and cast the ray from where it enters the pixel's cell
+    // if no wall stops it before. The cells it crosses on the way hold no wall, so the ray can start there.
+    auto refine_towards = [&](int end_x, int end_y)
+    {
+        if (!is_in_view_range(end_x, end_y, px, py, lower_bound_of_view, upper_bound_of_view))
+            return;
+        float entry = 0; // the player's cell is entered at the player.
+        bool clear = walk_cells(map, rect_w, rect_h, px, py, end_x + 0.5f, end_y + 0.5f, [&](int i, int j, float t)
+                                {
+                                    entry = t;
+                                    return map.map[i + j * map.w] == ' '; });
+        if (!clear)
+            return;
+        fixed_t end_fx = ((fixed_t)end_x << FIXED_SHIFT) + FIXED_ONE / 2;
+        fixed_t end_fy = ((fixed_t)end_y << FIXED_SHIFT) + FIXED_ONE / 2;
+        FixedPoint start = {origin.x + (fixed_t)(entry * (end_fx - origin.x)), origin.y + (fixed_t)(entry * (end_fy - origin.y))};
+        cast_ray(start, end_x, end_y, win_w, win_h, hit_map, framebuffer, visible);
+    };
+    for (int j = 0; j < map.h; j++)
     {
-        std::swap(intersection.x, intersection.y);
+        for (int i = 0; i < map.w; i++)
+        {
+            if (cells[i + j * map.w] != CELL_PARTIAL)
+                continue;
+            int x0 = i * rect_w;
+            int y0 = j * rect_h;
+            int x1 = x0 + rect_w - 1;
+            int y1 = y0 + rect_h - 1;
+            // every ray through the cell leaves it through a side that has the player on its inner side.
+            for (int x = x0; x <= x1; x++)
+            {
+                if (py > y0)
+                    refine_towards(x, y0);
+                if (py < y1 + 1)
+                    refine_towards(x, y1);
+            }
+            for (int y = y0; y <= y1; y++)
+            {
+                if (px > x0)
+                    refine_towards(x0, y);
+                if (px < x1 + 1)
+                    refine_towards(x1, y);
+            }
+        }
     }
-    std::cout << "The intersection for angle: " << theta << " is ("
-              << intersection.x << "," << intersection.y << ")" << std::endl;
-    return intersection;
 }
 
-// Utility function to normalize an angle to the range [0, 2*PI)
-float normalize_angle(float angle)
+// map rendering: background.
+void fill_background(std::vector<uint32_t> &framebuffer, const size_t win_w, const size_t win_h)
 {
-    while (angle < 0)
-        angle += 2 * M_PI;
-    while (angle >= 2 * M_PI)
-        angle -= 2 * M_PI;
-    return angle;
+    for (size_t j = 0; j < win_h; j++)
+    { // fill the screen with color gradients
+        for (size_t i = 0; i < win_w; i++)
+        {
+            framebuffer[i + j * win_w] = gradient_color(i, j, win_w, win_h);
+        }
+    }
 }
 
-bool is_in_view_range(float corner_x, float corner_y, float player_x, float player_y, float lower_bound_of_view, float upper_bound_of_view)
+// an indexed framebuffer only marks the background, the gradient is produced by encode_ppm_image().
+void fill_background(std::vector<uint8_t> &framebuffer, const size_t, const size_t)
 {
-    // Calculate the angle of the vertex with respect to the player's position
-    float vertex_angle = atan2(corner_y - player_y, corner_x - player_x);
+    std::fill(framebuffer.begin(), framebuffer.end(), PALETTE_GRADIENT);
+}
 
-    // Normalize the angles to be within [0, 2*PI)
-    lower_bound_of_view = normalize_angle(lower_bound_of_view);
-    upper_bound_of_view = normalize_angle(upper_bound_of_view);
-    vertex_angle = normalize_angle(vertex_angle);
+// render the static layer: the background and the walls, and generate the hit map.
+// it does not depend on the player, so it is rendered once and copied into every frame.
+template <typename Color>
+void render_static_layer(const Map &map, const size_t win_w, const size_t win_h, std::vector<Color> &framebuffer, const Color wall,
+                         std::vector<char> &hit_map)
+{
+    fill_background(framebuffer, win_w, win_h);
 
-    // Check if the vertex_angle lies between theta1 and theta2
-    if (lower_bound_of_view <= upper_bound_of_view)
-    {
-        return vertex_angle >= lower_bound_of_view && vertex_angle <= upper_bound_of_view;
-    }
-    else
-    {
-        // Handle the case where the range crosses the 0-degree (or 2 * PI) line
-        return vertex_angle >= lower_bound_of_view || vertex_angle <= upper_bound_of_view;
+    // map rendering: wall initialization. (render the wall and generate hit map)
+    const size_t rect_w = win_w / map.w; // the width of each map block
+    const size_t rect_h = win_h / map.h; // the height of each map block
+    for (int j = 0; j < map.h; j++)
+    { // draw the map
+        for (int i = 0; i < map.w; i++)
+        {
+            if (map.map[i + j * map.w] == ' ')
+                continue; // skip empty spaces
+            size_t rect_x = i * rect_w;
+            size_t rect_y = j * rect_h;
+            draw_rectangle(framebuffer, win_w, win_h, rect_x, rect_y, rect_w, rect_h, wall);
+            generate_hit_map(&hit_map, win_w, win_h, rect_x, rect_y, rect_w, rect_h, map.map[i + j * map.w]);
+        }
     }
 }
 
-int main()
+// fill the visibility polygon one scanline at a time.
+// a pixel is lit when its centre is inside the polygon; walls are never lit.
+// The edges are sorted by their first row and each row only sees the edges that cross it, so the cost is
+// in the number of lit pixels rather than in the bounding boxes of the polygon's triangles.
+template <typename Color>
+void fill_visibility_polygon(const std::vector<Point> &polygon, const size_t win_w, const size_t win_h, const std::vector<char> &hit_map,
+                             std::vector<Color> &framebuffer, const Color visible)
 {
-    const int win_w = 512; // image width
-    const int win_h = 512; // image height
-    // the constructor format is std::vector(size_t count, const T& value);
-    // first argument specifies the number of pixels.
-    // second argument uint32_t, set to 255, which means 3 bytes (RGB) are 0, and A is 255.
-    std::vector<uint32_t> framebuffer(win_w * win_h, 255); // the image itself, initialized to white
-    std::vector<char> hit_map(win_w * win_h, ' ');
-    const char map_char[] =
-        // "0000222222220000"
-        // "1              0"
-        // "1              0"
-        // "1              0"
-        // "0              0"
-        // "0              0"
-        // "0              0"
-        // "0              0"
-        // "0              0"
-        // "0              0"
-        // "0              0"
-        // "2              0"
-        // "0              0"
-        // "0              0"
-        // "0              0"
-        // "0002222222200000"; // empty game map
-        "0000222222220000"
-        "1              0"
-        "1      11111   0"
-        "1     0        0"
-        "0     0  1110000"
-        "0     3        0"
-        "0   10000      0"
-        "0   0   11100  0"
-        "0   0   0      0"
-        "0   0   1  00000"
-        "0       1      0"
-        "2       1      0"
-        "0       0      0"
-        "0 0000000      0"
-        "0              0"
-        "0002222222200000"; // our game map
-    Map map =
-        {
-            16,
-            16,
-            map_char};
-    assert(sizeof(map_char) == map.w * map.h + 1); // +1 for the null terminated string,
-    // because strings end with '\0'.Each row has map_h+1 columns.
-
-    // the player state.
-    float player_x = 13.456; // player x position
-    float player_y = 5.345;  // player y position
-    float degree = 155.8;
-    float player_a = (degree / 180) * M_PI;   // player view direction
-    float view_width = (270.0f / 180 * M_PI); // parameter; how wide the player can see.
-
-    Player player(player_x, player_y, player_a, view_width);
+    struct Edge
+    {
+        int first_row;
+        int end_row; // one past the last row
+        float x;     // where the edge crosses the centre line of the current row
+        float slope; // change of x from one row to the next
+    };
+    std::vector<Edge> edges;
+    for (size_t v = 0; v < polygon.size(); v++)
+    {
+        const Point &a = polygon[v];
+        const Point &b = polygon[(v + 1) % polygon.size()]; // the last edge closes the polygon back to the viewer.
+        if (a.y == b.y)
+            continue; // horizontal, it crosses no centre line.
+        const Point &top = a.y < b.y ? a : b;
+        const Point &bottom = a.y < b.y ? b : a;
+        // the rows whose centre line y + 0.5 is in [top.y, bottom.y).
+        int first_row = std::max(0, (int)std::ceil(top.y - 0.5f));
+        int end_row = std::min((int)win_h, (int)std::ceil(bottom.y - 0.5f));
+        if (first_row >= end_row)
+            continue;
+        float slope = (bottom.x - top.x) / (bottom.y - top.y);
+        edges.push_back({first_row, end_row, top.x + (first_row + 0.5f - top.y) * slope, slope});
+    }
+    std::sort(edges.begin(), edges.end(), [](const Edge &e, const Edge &f) { return e.first_row < f.first_row; });
 
-    for (int k = 0; k <= 24; k++) // test, render the player's view for every 15 degrees, and save an output. k is used to calculate the current player's angle. line 411.
+    std::vector<Edge> active;
+    std::vector<float> crossings;
+    size_t next_edge = 0;
+    for (int y = 0; y < (int)win_h && (next_edge < edges.size() || !active.empty()); y++)
     {
-        // map rendering: background.
-        for (size_t j = 0; j < win_h; j++)
-        { // fill the screen with color gradients
-            for (size_t i = 0; i < win_w; i++)
-            {
-                uint8_t r = 255 * j / float(win_h); // varies between 0 and 255 as j sweeps the vertical
-                uint8_t g = 255 * i / float(win_w); // varies between 0 and 255 as i sweeps the horizontal
-                uint8_t b = 0;
-                framebuffer[i + j * win_w] = pack_color(r, g, b);
-            }
-        }
+        active.erase(std::remove_if(active.begin(), active.end(), [&](const Edge &e) { return e.end_row <= y; }), active.end());
+        for (; next_edge < edges.size() && edges[next_edge].first_row == y; next_edge++)
+            active.push_back(edges[next_edge]);
 
-        // map rendering: wall initialization. (render the wall and generate hit map)
-        const size_t rect_w = win_w / map.w; // the width of each map block
-        const size_t rect_h = win_h / map.h; // the height of each map block
-        for (size_t j = 0; j < map.h; j++)
-        { // draw the map
-            for (size_t i = 0; i < map.w; i++)
+        crossings.clear();
+        for (Edge &e : active)
+        {
+            crossings.push_back(e.x);
+            e.x += e.slope;
+        }
+        std::sort(crossings.begin(), crossings.end());
+        // the row is inside the polygon between the first and the second crossing, the third and the fourth, and so on.
+        for (size_t k = 0; k + 1 < crossings.size(); k += 2)
+        {
+            int x0 = std::max(0, (int)std::ceil(crossings[k] - 0.5f));
+            int x1 = std::min((int)win_w, (int)std::ceil(crossings[k + 1] - 0.5f));
+            for (int x = x0; x < x1; x++)
             {
-                if (map.map[i + j * map.w] == ' ')
-                    continue; // skip empty spaces
-                size_t rect_x = i * rect_w;
-                size_t rect_y = j * rect_h;
-                draw_rectangle(framebuffer, win_w, win_h, rect_x, rect_y, rect_w, rect_h, pack_color(0, 255, 255));
-                generate_hit_map(&hit_map, win_w, win_h, rect_x, rect_y, rect_w, rect_h, map.map[i + j * map.w]);
+                if (hit_map[x + y * win_w] == ' ')
+                    framebuffer[x + y * win_w] = visible;
             }
         }
+    }
+}
 
+// how render_view() finds the visible pixels.
+enum ViewAlgorithm
+{
+    VIEW_EDGE_SWEEP,     // one ray to every pixel on the border of the window.
+    VIEW_COARSE_TO_FINE, // map cells first, rays only inside partial cells, see render_view_coarse().
+    VIEW_SWEEP_LINE      // exact visibility polygon from the wall segments, see visibility_polygon().
+};
+
+// render the player's view on top of a copy of the static layer.
+template <typename Color>
+void render_view(Player player, const Map &map, const size_t win_w, const size_t win_h, const std::vector<char> &hit_map,
+                 const std::vector<Segment> &walls, std::vector<Color> &framebuffer, const Color visible, ViewAlgorithm algorithm)
+{
+    // first find the end points of players view, which are the rays' intersection with the border.
+    float lower_bound_of_view = player.gaze_angle - player.view_width / 2; // lower bound of player view;
+    float upper_bound_of_view = player.gaze_angle + player.view_width / 2; // upper bound of player view;
+    FixedPoint origin = player.get_fixed_position(map, win_w, win_h); // the rays start from the exact sub-pixel position.
 
-        //TODO: change this to a method in player
-    const size_t rect_w = win_w / map.w; // the width of each map block
-    const size_t rect_h = win_h / map.h; // the height of each map block
-
-        player.gaze_angle = player.gaze_angle + M_PI / 180 * 15 * k; // increment the player angle by 15 degree for this round.
-        // first find the end points of players view, which are the rays' intersection with the border.
-        float lower_bound_of_view = player.gaze_angle - player.view_width / 2; // lower bound of player view;
-        float upper_bound_of_view = player.gaze_angle + player.view_width / 2; // upper bound of player view;
+    if (algorithm == VIEW_SWEEP_LINE)
+    {
+        Point exact = {(float)origin.x / FIXED_ONE, (float)origin.y / FIXED_ONE};
+        std::vector<Point> polygon = visibility_polygon(exact, lower_bound_of_view, player.view_width, walls);
+        fill_visibility_polygon(polygon, win_w, win_h, hit_map, framebuffer, visible);
+    }
+    else if (algorithm == VIEW_COARSE_TO_FINE)
+    {
+        render_view_coarse(map, origin, lower_bound_of_view, upper_bound_of_view, win_w, win_h, hit_map, framebuffer, visible);
+    }
+    else
+    {
         // pre-treatment: find the map_corners to iterate;
-        // calculate the intersection.
-        size_t px = player.get_pixel_position(map).x;
-        size_t py = player.get_pixel_position(map).y;
-        Point intersection1 = find_intersection(lower_bound_of_view, px, py, win_w, win_h);
-        Point intersection2 = find_intersection(upper_bound_of_view, px, py, win_w, win_h);
-        // End TODO.
+        Pixel pixel_position = player.get_pixel_position(map, win_w, win_h);
+        size_t px = pixel_position.x;
+        size_t py = pixel_position.y;
 
         // transfer intersection (pixel) to ints to reduce calculation.
         // TODO: round down only? Need to consider >0.5 case.
-        std::pair<Pixel, Pixel> end_points = player.find_view_ranges(map);
+        std::pair<Pixel, Pixel> end_points = player.find_view_ranges(map, win_w, win_h);
         Pixel start = end_points.first;
         Pixel end = end_points.second;
 
@@ -426,59 +676,24 @@ int main()
         // B===============A
 
         Pixel map_corners[4] = {
-            {win_w, win_h},
-            {0, win_h},
+            {(int)win_w, (int)win_h},
+            {0, (int)win_h},
             {0, 0},
-            {win_w, 0} };
-
-        int i;                          // index of the map_corners to start scanning
-        int diff_x = start.x - (int)px; // intersection's horizontal distance to the player, used to determine quadrant.
-        int diff_y = start.y - (int)py; // intersection's vertical distance to the player, used to determine quadrant.
-        if (diff_x == 0 && diff_y == 0)
-        {
-            // on one of the corners
-            // use px py to determine corner
-            if (px == win_w && px == win_h)
-                i = 0; // on A, start with A
-            if (px == 0 && px == win_h)
-                i = 1; // on B, start with B
-            if (px == win_w && px == win_h)
-                i = 2; // on C, start with C
-            if (px == win_w && px == win_h)
-                i = 3; // on D, start with D
-        }
-
-        if (diff_x == 0)
-        {
-            if (px == 0)
-                i = 1; // on left edge, start with B or C. Let say B.
-            if (px == win_w)
-                i = 0; // on right edge, start with A or D. Let say A.
-        }
-
-        if (diff_y == 0)
-        {
-            // on top or bottom edge
-            if (py == 0)
-                i = 2; // on top edge, start with C or D. Let say C.
-            if (py == win_h)
-                i = 1; // on top edge, start with A or B. Let say A.
-        }
-        if (diff_x > 0 && diff_y > 0)
-        {
-            i = 0;
-        }
-        else if (diff_x < 0 && diff_y > 0)
-        {
-            i = 1;
-        }
-        else if (diff_x < 0 && diff_y < 0)
+            {(int)win_w, 0} };
+
+        // index of the map_corners to start scanning: the first corner the sweep meets after the lower bound of the view.
+        // the corners are in clockwise order, so the others follow from it. Comparing angles, rather than looking at
+        // the quadrant of the start point, also works when the start point is straight above, below or beside the player.
+        int i = 0;
+        float first_offset = 2 * M_PI;
+        for (int c = 0; c < 4; c++)
         {
-            i = 2;
-        }
-        else if (diff_x > 0 && diff_y < 0)
-        {
-            i = 3;
+            float offset = normalize_angle(atan2((float)map_corners[c].y - py, (float)map_corners[c].x - px) - lower_bound_of_view);
+            if (offset < first_offset)
+            {
+                first_offset = offset;
+                i = c;
+            }
         }
 
         std::vector<Pixel> points_to_cast;
@@ -511,7 +726,7 @@ int main()
                 }
                 for (int j = start_y; j < end_y; j++)
                 {
-                    cast_ray(px, py, points_to_cast[i].x, j, win_w, win_h, hit_map, framebuffer);
+                    cast_ray(origin, points_to_cast[i].x, j, win_w, win_h, hit_map, framebuffer, visible);
                 }
             }
             // on the same horizontal line
@@ -525,25 +740,166 @@ int main()
                 }
                 for (int j = start_x; j < end_x; j++)
                 {
-                    cast_ray(px, py, j, points_to_cast[i].y, win_w, win_h, hit_map, framebuffer);
+                    cast_ray(origin, j, points_to_cast[i].y, win_w, win_h, hit_map, framebuffer, visible);
                 }
             }
         }
         // raycasting: render a ray that represents the gaze of the player.
         // cast_ray() draws a line to connect the begin and end map_corners.
-        cast_ray(px, py, (int)intersection1.x, (int)intersection1.y, win_w, win_h, hit_map, framebuffer);
-        cast_ray(px, py, (int)intersection2.x, (int)intersection2.y, win_w, win_h, hit_map, framebuffer);
-        // draw player's position
-        draw_rectangle(framebuffer, win_w, win_h, px - 2, py - 2, 5, 5, pack_color(255, 0, 0));
-        std::string build_folder = "output/";              // Define a relative path inside the build folder
-        std::filesystem::create_directories(build_folder); // Ensure the folder exists
-
-        std::string file_path = build_folder + "out_" + std::to_string(k) + ".ppm";
-        std::cout << "Saving to: " << file_path << std::endl;
-
-        drop_ppm_image(file_path, framebuffer, win_w, win_h);
-        std::cout << "wrote file." << std::endl;
+        cast_ray(origin, start.x, start.y, win_w, win_h, hit_map, framebuffer, visible);
+        cast_ray(origin, end.x, end.y, win_w, win_h, hit_map, framebuffer, visible);
     }
+}
+
+int main(int argc, char **argv)
+{
+    const int win_w = 512; // image width
+    const int win_h = 512; // image height
+    std::vector<char> hit_map(win_w * win_h, ' ');
+    const char map_char[] =
+        // "0000222222220000"
+        // "1              0"
+        // "1              0"
+        // "1              0"
+        // "0              0"
+        // "0              0"
+        // "0              0"
+        // "0              0"
+        // "0              0"
+        // "0              0"
+        // "0              0"
+        // "2              0"
+        // "0              0"
+        // "0              0"
+        // "0              0"
+        // "0002222222200000"; // empty game map
+        "0000222222220000"
+        "1              0"
+        "1      11111   0"
+        "1     0        0"
+        "0     0  1110000"
+        "0     3        0"
+        "0   10000      0"
+        "0   0   11100  0"
+        "0   0   0      0"
+        "0   0   1  00000"
+        "0       1      0"
+        "2       1      0"
+        "0       0      0"
+        "0 0000000      0"
+        "0              0"
+        "0002222222200000"; // our game map
+    Map map =
+        {
+            16,
+            16,
+            map_char};
+    assert(sizeof(map_char) == map.w * map.h + 1); // +1 for the null terminated string,
+    // because strings end with '\0'.Each row has map_h+1 columns.
+
+    // the player state.
+    float player_x = 13.456; // player x position
+    float player_y = 5.345;  // player y position
+    float degree = 155.8;
+    float player_a = (degree / 180) * M_PI;   // player view direction
+    float view_width = (270.0f / 180 * M_PI); // parameter; how wide the player can see.
+    const ViewAlgorithm algorithm = VIEW_EDGE_SWEEP; // how the visible pixels are found, see ViewAlgorithm.
+    const bool indexed_color = true;          // render into one byte per pixel, see palette_color().
+    const size_t render_threads = std::max(1u, std::thread::hardware_concurrency()); // frames rendered at the same time.
+
+    Player player(player_x, player_y, view_width, player_a);
+
+    // the background and the walls, only the layer of the selected color mode is allocated.
+    std::vector<uint32_t> static_layer;
+    std::vector<uint8_t> indexed_static_layer;
+    if (indexed_color)
+    {
+        indexed_static_layer.assign(win_w * win_h, PALETTE_GRADIENT);
+        render_static_layer<uint8_t>(map, win_w, win_h, indexed_static_layer, PALETTE_WALL, hit_map);
+    }
+    else
+    {
+        // the assign format is assign(size_t count, const T& value);
+        // first argument specifies the number of pixels.
+        // second argument uint32_t, set to 255, which means 3 bytes (RGB) are 0, and A is 255.
+        static_layer.assign(win_w * win_h, 255); // initialized to white
+        render_static_layer(map, win_w, win_h, static_layer, pack_color(0, 255, 255), hit_map);
+    }
+    assert(boundary_rays_reach_end(map, win_w, win_h, hit_map)); // see step_ray().
+    std::vector<Segment> walls = extract_wall_segments(map, win_w / map.w, win_h / map.h); // outline of the walls for VIEW_SWEEP_LINE.
+
+    // server mode: keep the map loaded and answer viewer queries, see query_server.h for the protocol.
+    // tinyraycaster --serve              reads queries from stdin, replies on stdout.
+    // tinyraycaster --serve <socket>     listens on a unix domain socket.
+    if (argc > 1 && std::string(argv[1]) == "--serve")
+    {
+        // results are kept for viewers within one pixel and 1/4096 turn of each other, in at most 256 MB.
+        const uint32_t map_version = 0; // bump with cache.invalidate() when the map changes.
+        VisibilityCache cache(256 << 20, map.w, map.h, 1.0f / (win_w / map.w), 2 * M_PI / 4096, map_version);
+        QueryServer server(
+            win_w, win_h, render_threads, 64, std::chrono::microseconds(500),
+            [&](const ViewerQuery &query)
+            {
+                // written so that NaN fails every test.
+                return query.x >= 0 && query.x < map.w && query.y >= 0 && query.y < map.h &&
+                       query.view_width > 0 && query.view_width < 2 * M_PI && std::isfinite(query.gaze_angle);
+            },
+            [&](const ViewerQuery &query, std::vector<uint8_t> &framebuffer)
+            {
+                Player viewer(query.x, query.y, query.view_width, query.gaze_angle);
+                render_view<uint8_t>(viewer, map, win_w, win_h, hit_map, walls, framebuffer, PALETTE_VISIBLE, algorithm);
+            },
+            &cache);
+        return argc > 2 ? server.serve_socket(argv[2]) : server.serve_stdin();
+    }
+
+    std::string build_folder = "output/";              // Define a relative path inside the build folder
+    std::filesystem::create_directories(build_folder); // Ensure the folder exists
+
+    // test, render the player's view for every 15 degrees, and save an output. frame k is the player turned by 15 * k degrees.
+    // the frames only read the static layer and the hit map, so they are rendered in parallel and written in order.
+    const int frame_count = 25;
+    FrameScheduler scheduler(render_threads, 2 * render_threads);
+    scheduler.run(
+        frame_count,
+        [&](Frame &frame)
+        {
+            Player view = player;
+            view.gaze_angle = player.gaze_angle + M_PI / 180 * 15 * frame.index;
+            Pixel position = view.get_pixel_position(map, win_w, win_h);
+            if (indexed_color)
+            {
+                frame.indexed = indexed_static_layer;
+                render_view<uint8_t>(view, map, win_w, win_h, hit_map, walls, frame.indexed, PALETTE_VISIBLE, algorithm);
+                // draw player's position
+                draw_rectangle<uint8_t>(frame.indexed, win_w, win_h, position.x - 2, position.y - 2, 5, 5, PALETTE_PLAYER);
+            }
+            else
+            {
+                frame.pixels = static_layer;
+                render_view(view, map, win_w, win_h, hit_map, walls, frame.pixels, pack_color(255, 255, 255), algorithm);
+                // draw player's position
+                draw_rectangle(frame.pixels, win_w, win_h, position.x - 2, position.y - 2, 5, 5, pack_color(255, 0, 0));
+            }
+        },
+        [&](Frame &frame)
+        {
+            if (indexed_color)
+                frame.bytes = encode_ppm_image(frame.indexed, win_w, win_h);
+            else
+                frame.bytes = encode_ppm_image(frame.pixels, win_w, win_h);
+            // the framebuffers are not needed once encoded.
+            std::vector<uint32_t>().swap(frame.pixels);
+            std::vector<uint8_t>().swap(frame.indexed);
+        },
+        [&](const Frame &frame)
+        {
+            std::string file_path = build_folder + "out_" + std::to_string(frame.index) + ".ppm";
+            std::cout << "Saving to: " << file_path << std::endl;
+
+            drop_image_bytes(file_path, frame.bytes);
+            std::cout << "wrote file." << std::endl;
+        });
     std::cout << "Done." << std::endl;
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,165 @@
+#include "visibility_cache.h"
+#include <mutex>
+
+namespace
+{
+    // the step that value falls in, clamped to [first, last] before it is narrowed to 32 bits.
+    int32_t quantize(float value, float step, int32_t first, int32_t last)
+    {
+        assert(std::isfinite(value));
+        double index = std::floor((double)value / step);
+        return (int32_t)std::min<double>(std::max<double>(index, first), last);
+    }
+}
+
+size_t VisibilityKeyHash::operator()(const VisibilityKey &key) const
+{
+    // FNV-1a over the fields.
+    uint64_t hash = 1469598103934665603ull;
+    const int32_t fields[5] = {(int32_t)key.map_version, key.x, key.y, key.gaze_angle, key.view_width};
+    for (int32_t field : fields)
+    {
+        hash ^= (uint32_t)field;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+VisibilityCache::VisibilityCache(size_t memory_budget, float map_w, float map_h, float position_step, float angle_step, uint32_t map_version)
+{
+    assert(map_w > 0 && map_h > 0);
+    assert(position_step > 0);
+    assert(angle_step > 0);
+    assert(std::max(map_w, map_h) / position_step < INT32_MAX && 2 * M_PI / angle_step < INT32_MAX);
+
+    this->memory_budget = memory_budget;
+    this->map_w = map_w;
+    this->map_h = map_h;
+    this->position_step = position_step;
+    this->angle_step = angle_step;
+    this->last_x = (int32_t)std::ceil(map_w / position_step) - 1;
+    this->last_y = (int32_t)std::ceil(map_h / position_step) - 1;
+    this->last_angle = (int32_t)std::ceil(2 * M_PI / angle_step) - 1;
+    this->map_version = map_version;
+    this->used_bytes = 0;
+    this->tick = 0;
+    this->hit_count = 0;
+    this->miss_count = 0;
+    this->eviction_count = 0;
+}
+
+VisibilityCache::~VisibilityCache() {}
+
+VisibilityKey VisibilityCache::make_key(float x, float y, float gaze_angle, float view_width) const
+{
+    float gaze = std::fmod(gaze_angle, 2 * (float)M_PI);
+    if (gaze < 0)
+        gaze += 2 * M_PI;
+
+    VisibilityKey key;
+    key.map_version = map_version;
+    key.x = quantize(x, position_step, 0, last_x);
+    key.y = quantize(y, position_step, 0, last_y);
+    key.gaze_angle = quantize(gaze, angle_step, 0, last_angle); // fmod() can round up to 2 * PI.
+    key.view_width = quantize(view_width, angle_step, 1, last_angle); // a view of width 0 would be rejected.
+    return key;
+}
+
+void VisibilityCache::snapped_state(const VisibilityKey &key, float &x, float &y, float &gaze_angle, float &view_width) const
+{
+    // the last step can reach past the edge of the map.
+    x = (key.x * position_step + std::min((key.x + 1) * position_step, map_w)) / 2;
+    y = (key.y * position_step + std::min((key.y + 1) * position_step, map_h)) / 2;
+    gaze_angle = key.gaze_angle * angle_step;
+    view_width = key.view_width * angle_step;
+}
+
+size_t VisibilityCache::entry_bytes(const Entry &entry)
+{
+    // the mask, the list node and the index slot.
+    return entry.mask->size() + sizeof(Entry) + sizeof(VisibilityKey) + 4 * sizeof(void *);
+}
+
+bool VisibilityCache::lookup(const VisibilityKey &key, std::shared_ptr<const std::string> &mask)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto found = index.find(key);
+    if (found == index.end())
+    {
+        miss_count++;
+        return false;
+    }
+    found->second->last_used.store(++tick, std::memory_order_relaxed);
+    mask = found->second->mask;
+    hit_count++;
+    return true;
+}
+
+void VisibilityCache::insert(const VisibilityKey &key, std::shared_ptr<const std::string> mask)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    if (key.map_version != map_version || index.count(key))
+        return; // stale, or another thread got there first.
+
+    entries.emplace_front();
+    Entry &entry = entries.front();
+    entry.key = key;
+    entry.mask = std::move(mask);
+    entry.queued_at = ++tick;
+    entry.last_used = entry.queued_at;
+    size_t size = entry_bytes(entry);
+    if (size > memory_budget)
+    {
+        entries.pop_front(); // would not fit even in an empty cache.
+        return;
+    }
+    index[key] = entries.begin();
+    used_bytes += size;
+
+    // evict from the cold end, giving a second chance to the entries read since they were queued.
+    while (used_bytes > memory_budget)
+    {
+        auto coldest = std::prev(entries.end());
+        uint64_t last_used = coldest->last_used.load(std::memory_order_relaxed);
+        if (last_used > coldest->queued_at)
+        {
+            coldest->queued_at = last_used;
+            entries.splice(entries.begin(), entries, coldest);
+            continue;
+        }
+        used_bytes -= entry_bytes(*coldest);
+        index.erase(coldest->key);
+        entries.erase(coldest);
+        eviction_count++;
+    }
+}
+
+void VisibilityCache::invalidate(uint32_t new_map_version)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    map_version = new_map_version;
+    index.clear();
+    entries.clear();
+    used_bytes = 0;
+}
+
+uint64_t VisibilityCache::hits() const
+{
+    return hit_count;
+}
+
+uint64_t VisibilityCache::misses() const
+{
+    return miss_count;
+}
+
+uint64_t VisibilityCache::evictions() const
+{
+    return eviction_count;
+}
+
+size_t VisibilityCache::bytes() const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return used_bytes;
+}
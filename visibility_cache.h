@@ -0,0 +1,94 @@
+#ifndef VISIBILITY_CACHE_H
+#define VISIBILITY_CACHE_H
+#include <global_variables.h>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+// viewer state after quantization. Two viewers with the same key get the same visibility result.
+struct VisibilityKey
+{
+    uint32_t map_version;
+    int32_t x;          // the step of position_step map cells the position falls in
+    int32_t y;
+    int32_t gaze_angle; // the step of angle_step radians the angle falls in, the gaze normalized to [0, 2 * PI)
+    int32_t view_width;
+
+    bool operator==(const VisibilityKey &other) const
+    {
+        return map_version == other.map_version && x == other.x && y == other.y &&
+               gaze_angle == other.gaze_angle && view_width == other.view_width;
+    }
+};
+
+struct VisibilityKeyHash
+{
+    size_t operator()(const VisibilityKey &key) const;
+};
+
+// LRU cache of visibility results (packed masks), bounded by memory_budget bytes.
+// Lookups only take a shared lock and stamp the entry with a use tick, so readers never wait on each other;
+// the recency list is fixed up lazily on insert: an entry at the cold end that was used since it was queued
+// gets a second chance at the hot end, otherwise it is evicted.
+class VisibilityCache
+{
+public:
+    // positions are in [0, map_w) x [0, map_h) map cells.
+    VisibilityCache(size_t memory_budget, float map_w, float map_h, float position_step, float angle_step, uint32_t map_version = 0);
+    ~VisibilityCache();
+
+    // the viewer state must be valid (finite, on the map, view_width in (0, 2 * PI)): reject a query before making its key.
+    // every field is rounded down and clamped to the steps of a valid state, so the key stands for a valid state too.
+    VisibilityKey make_key(float x, float y, float gaze_angle, float view_width) const;
+    // the viewer state a key stands for, with the position at the centre of its step (clipped to the map): it is within
+    // half a step of every viewer with that key, and off the wall lines when they lie on step boundaries.
+    // A miss must be computed for this state, not the original one, otherwise the cached result would depend on
+    // which viewer asked first.
+    void snapped_state(const VisibilityKey &key, float &x, float &y, float &gaze_angle, float &view_width) const;
+
+    bool lookup(const VisibilityKey &key, std::shared_ptr<const std::string> &mask);
+    void insert(const VisibilityKey &key, std::shared_ptr<const std::string> mask);
+    // the map changed: drop every result. Keys made for the old version never match again.
+    void invalidate(uint32_t new_map_version);
+
+    uint64_t hits() const;
+    uint64_t misses() const;
+    uint64_t evictions() const;
+    size_t bytes() const;
+
+private:
+    struct Entry
+    {
+        VisibilityKey key;
+        std::shared_ptr<const std::string> mask;
+        std::atomic<uint64_t> last_used; // tick of the latest lookup, written under the shared lock.
+        uint64_t queued_at;              // tick when the entry was put at the hot end of the list.
+    };
+
+    size_t memory_budget;
+    float map_w;
+    float map_h;
+    float position_step;
+    float angle_step;
+    int32_t last_x; // the last step of each field of a valid state.
+    int32_t last_y;
+    int32_t last_angle;
+    std::atomic<uint32_t> map_version;
+
+    mutable std::shared_mutex mutex;
+    std::list<Entry> entries; // hot end at the front.
+    std::unordered_map<VisibilityKey, std::list<Entry>::iterator, VisibilityKeyHash> index;
+    size_t used_bytes;
+
+    std::atomic<uint64_t> tick;
+    std::atomic<uint64_t> hit_count;
+    std::atomic<uint64_t> miss_count;
+    std::atomic<uint64_t> eviction_count;
+
+    static size_t entry_bytes(const Entry &entry);
+};
+
+#endif // VISIBILITY_CACHE_H
@@ -0,0 +1,248 @@
+#include "visibility_polygon.h"
+#include <set>
+
+namespace
+{
+    // the part of a segment that lies inside the view, as angles relative to the lower bound of the view.
+    struct Interval
+    {
+        double start;
+        double end;
+        size_t segment;
+    };
+
+    // interval segment for the directions that are blocked right at the origin, see visibility_polygon().
+    const size_t at_origin = SIZE_MAX;
+
+    double normalize(double angle)
+    {
+        angle = std::fmod(angle, 2 * M_PI);
+        return angle < 0 ? angle + 2 * M_PI : angle;
+    }
+
+    // distance from the origin to the line of the segment, along the ray at angle theta.
+    double ray_distance(const Point &origin, double theta, const Segment &segment)
+    {
+        double dx = std::cos(theta);
+        double dy = std::sin(theta);
+        double rx = segment.b.x - segment.a.x;
+        double ry = segment.b.y - segment.a.y;
+        double denominator = dx * ry - dy * rx;
+        if (denominator == 0)
+            return INFINITY; // the ray runs along the segment.
+        return ((segment.a.x - origin.x) * ry - (segment.a.y - origin.y) * rx) / denominator;
+    }
+
+    // orders the segments crossing the sweep ray by their distance to the origin.
+    // The segments only meet at their end points, which are event angles, so the order of two segments does not change
+    // while both are in the tree; only sweep_angle moves, and it is always set to a ray that crosses every segment in the tree.
+    struct CloserToOrigin
+    {
+        const Point *origin;
+        const std::vector<Segment> *walls;
+        const std::vector<Interval> *intervals;
+        const double *sweep_angle;
+
+        double distance(size_t i) const
+        {
+            size_t segment = (*intervals)[i].segment;
+            return segment == at_origin ? 0 : ray_distance(*origin, *sweep_angle, (*walls)[segment]);
+        }
+
+        bool operator()(size_t i, size_t j) const
+        {
+            double di = distance(i);
+            double dj = distance(j);
+            if (di != dj)
+                return di < dj;
+            return i < j;
+        }
+    };
+}
+
+std::vector<Segment> extract_wall_segments(const Map &map, float rect_w, float rect_h)
+{
+    auto is_wall = [&](int i, int j)
+    {
+        if (i < 0 || j < 0 || i >= map.w || j >= map.h)
+            return true;
+        return map.map[i + j * map.w] != ' ';
+    };
+
+    // which side of the edge between cells (i0, j0) and (i1, j1) the wall is on: 1 for the second cell,
+    // -1 for the first one, 0 if both or none are walls.
+    auto wall_side = [&](int i0, int j0, int i1, int j1)
+    {
+        if (is_wall(i0, j0) == is_wall(i1, j1))
+            return 0;
+        return is_wall(i1, j1) ? 1 : -1;
+    };
+
+    std::vector<Segment> walls;
+    // horizontal edges: the line y = j lies between row j - 1 and row j.
+    for (int j = 0; j <= map.h; j++)
+    {
+        int run_start = 0;
+        int run_side = 0;
+        for (int i = 0; i <= map.w; i++)
+        {
+            int side = i < map.w ? wall_side(i, j - 1, i, j) : 0;
+            if (side == run_side)
+                continue;
+            if (run_side < 0) // the wall is above.
+                walls.push_back({{run_start * rect_w, j * rect_h}, {i * rect_w, j * rect_h}});
+            if (run_side > 0) // the wall is below.
+                walls.push_back({{i * rect_w, j * rect_h}, {run_start * rect_w, j * rect_h}});
+            run_start = i;
+            run_side = side;
+        }
+    }
+    // vertical edges: the line x = i lies between column i - 1 and column i.
+    for (int i = 0; i <= map.w; i++)
+    {
+        int run_start = 0;
+        int run_side = 0;
+        for (int j = 0; j <= map.h; j++)
+        {
+            int side = j < map.h ? wall_side(i - 1, j, i, j) : 0;
+            if (side == run_side)
+                continue;
+            if (run_side > 0) // the wall is on the right.
+                walls.push_back({{i * rect_w, run_start * rect_h}, {i * rect_w, j * rect_h}});
+            if (run_side < 0) // the wall is on the left.
+                walls.push_back({{i * rect_w, j * rect_h}, {i * rect_w, run_start * rect_h}});
+            run_start = j;
+            run_side = side;
+        }
+    }
+    return walls;
+}
+
+std::vector<Point> visibility_polygon(Point origin, float lower_bound_of_view, float view_width, const std::vector<Segment> &walls)
+{
+    // step 1: turn every segment into the range of angles it covers, clipped to the view.
+    std::vector<Interval> intervals;
+    auto add_interval = [&](double start, double end, size_t segment)
+    {
+        end = std::min(end, (double)view_width);
+        if (start < end)
+            intervals.push_back({start, end, segment});
+    };
+    // the segments through the origin have no angular extent to sweep: from their end points they are seen edge-on,
+    // and from inside they span exactly half a turn, without telling which half they hide. Each of them is one or two
+    // half-lines from the origin instead, along the axes, with a wall quadrant on one side and an empty one on the other.
+    // A quadrant is a wall when the closest half-line below it in angle has the wall on its upper side, and wall
+    // quadrants are blocked right at the origin.
+    int half_line[4] = {0, 0, 0, 0}; // by direction in quarter turns from +x: 1 wall above in angle, -1 below, 0 none.
+    std::vector<bool> through_origin(walls.size(), false);
+    for (size_t s = 0; s < walls.size(); s++)
+    {
+        const Segment &wall = walls[s];
+        bool on_line = wall.a.y == wall.b.y ? origin.y == wall.a.y : origin.x == wall.a.x;
+        if (!on_line || origin.x < std::min(wall.a.x, wall.b.x) || origin.x > std::max(wall.a.x, wall.b.x) ||
+            origin.y < std::min(wall.a.y, wall.b.y) || origin.y > std::max(wall.a.y, wall.b.y))
+            continue;
+        through_origin[s] = true;
+        for (const Point &end : {wall.a, wall.b})
+        {
+            float dx = end.x - origin.x;
+            float dy = end.y - origin.y;
+            if (dx == 0 && dy == 0)
+                continue;
+            int direction = dx > 0 ? 0 : dy > 0 ? 1 : dx < 0 ? 2 : 3;
+            // the wall lies towards (b.y - a.y, a.x - b.x), increasing angles towards (-dy, dx).
+            double side = (wall.b.y - wall.a.y) * -dy + (wall.a.x - wall.b.x) * dx;
+            half_line[direction] = side > 0 ? 1 : -1;
+        }
+    }
+    for (int quadrant = 0; quadrant < 4; quadrant++)
+    {
+        int below = quadrant;
+        for (int k = 0; k < 4 && half_line[below] == 0; k++)
+            below = (below + 3) % 4;
+        if (half_line[below] <= 0)
+            continue;
+        double start = normalize(quadrant * M_PI / 2 - lower_bound_of_view);
+        add_interval(start, std::min(start + M_PI / 2, 2 * M_PI), at_origin);
+        if (start + M_PI / 2 > 2 * M_PI)
+            add_interval(0, start + M_PI / 2 - 2 * M_PI, at_origin);
+    }
+
+    const double epsilon = 1e-9;
+    for (size_t s = 0; s < walls.size(); s++)
+    {
+        if (through_origin[s])
+            continue;
+        double a1 = normalize(std::atan2(walls[s].a.y - origin.y, walls[s].a.x - origin.x) - lower_bound_of_view);
+        double a2 = normalize(std::atan2(walls[s].b.y - origin.y, walls[s].b.x - origin.x) - lower_bound_of_view);
+        double start = std::min(a1, a2);
+        double end = std::max(a1, a2);
+        if (end - start < epsilon)
+            continue; // seen edge-on, it hides nothing.
+        if (end - start < M_PI)
+        {
+            add_interval(start, end, s);
+        }
+        else
+        {
+            // the segment crosses the lower bound of the view, split it there.
+            add_interval(end, 2 * M_PI, s);
+            add_interval(0, start, s);
+        }
+    }
+
+    // step 2: the event angles, where a segment enters or leaves the sweep.
+    std::vector<double> angles = {0, view_width};
+    for (const Interval &interval : intervals)
+    {
+        angles.push_back(interval.start);
+        angles.push_back(interval.end);
+    }
+    std::sort(angles.begin(), angles.end());
+    angles.erase(std::unique(angles.begin(), angles.end()), angles.end());
+
+    std::vector<size_t> by_start(intervals.size());
+    for (size_t i = 0; i < by_start.size(); i++)
+        by_start[i] = i;
+    std::vector<size_t> by_end = by_start;
+    std::sort(by_start.begin(), by_start.end(), [&](size_t i, size_t j) { return intervals[i].start < intervals[j].start; });
+    std::sort(by_end.begin(), by_end.end(), [&](size_t i, size_t j) { return intervals[i].end < intervals[j].end; });
+
+    // step 3: sweep. Between two event angles the closest segment is the visible one.
+    double sweep_angle = 0;
+    std::set<size_t, CloserToOrigin> active(CloserToOrigin{&origin, &walls, &intervals, &sweep_angle});
+    std::vector<std::set<size_t, CloserToOrigin>::iterator> position(intervals.size());
+    size_t next_start = 0;
+    size_t next_end = 0;
+
+    std::vector<Point> polygon = {origin};
+    auto add_point = [&](double angle, size_t segment)
+    {
+        double theta = lower_bound_of_view + angle;
+        double distance = segment == at_origin ? 0 : ray_distance(origin, theta, walls[segment]);
+        Point p = {(float)(origin.x + distance * std::cos(theta)), (float)(origin.y + distance * std::sin(theta))};
+        if (polygon.size() == 1 || polygon.back().x != p.x || polygon.back().y != p.y)
+            polygon.push_back(p);
+    };
+
+    for (size_t k = 0; k + 1 < angles.size() && angles[k] < view_width; k++)
+    {
+        while (next_end < by_end.size() && intervals[by_end[next_end]].end <= angles[k])
+        {
+            active.erase(position[by_end[next_end]]);
+            next_end++;
+        }
+        sweep_angle = lower_bound_of_view + (angles[k] + angles[k + 1]) / 2;
+        while (next_start < by_start.size() && intervals[by_start[next_start]].start <= angles[k])
+        {
+            position[by_start[next_start]] = active.insert(by_start[next_start]).first;
+            next_start++;
+        }
+        if (active.empty())
+            continue;
+        size_t closest = intervals[*active.begin()].segment;
+        add_point(angles[k], closest);
+        add_point(angles[k + 1], closest);
+    }
+    return polygon;
+}
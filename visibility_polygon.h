@@ -0,0 +1,26 @@
+#ifndef VISIBILITY_POLYGON_H
+#define VISIBILITY_POLYGON_H
+#include <global_variables.h>
+
+struct Segment
+{
+    Point a;
+    Point b;
+};
+
+// outline of the walls in pixel coordinates: every edge between a wall cell and an empty cell, with neighbouring
+// edges on the same line merged as long as the wall stays on the same side. Outside of the map counts as wall,
+// so the outline is always closed, and two segments only ever meet at their end points: where two wall cells
+// touch at a corner only, the runs through that corner are split there. Each segment runs with the wall on its left
+// as seen on screen, towards (b.y - a.y, a.x - b.x), so the walls are outlined counterclockwise.
+// The number of segments depends on the shape of the walls, not on the window resolution.
+std::vector<Segment> extract_wall_segments(const Map &map, float rect_w, float rect_h);
+
+// exact visibility polygon of a viewer at origin who sees the angles [lower_bound_of_view, lower_bound_of_view + view_width].
+// the wall segments are swept by angle around the origin, keeping the segments that cross the sweep ray in a balanced
+// tree ordered by distance, so the cost is O(n log n) in the number of segments.
+// The first point is the origin, the others follow the sweep by increasing angle; consecutive points with the origin
+// form the triangles of the visible area.
+std::vector<Point> visibility_polygon(Point origin, float lower_bound_of_view, float view_width, const std::vector<Segment> &walls);
+
+#endif // VISIBILITY_POLYGON_H